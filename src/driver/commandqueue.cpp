@@ -0,0 +1,119 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#include "commandqueue.hpp"
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+bool CommandQueue :: push(uint64_t connectionId, std::string_view line) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t position = pushPosition.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[position & mask];
+            // Sequentially consistent like the store in pop, so that a
+            // producer setting producerBlocked cannot miss a freed slot
+            const size_t sequence = slot.sequence.load();
+            const intptr_t difference = (intptr_t) (sequence - position);
+            if (difference == 0) {
+                if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.command.connectionId = connectionId;
+                    slot.command.line.assign(line.data(), line.size());
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                // Full. The consumer checks producerBlocked after freeing a
+                // slot, so either the second attempt succeeds or the
+                // consumer reports the blocked producer.
+                break;
+            } else {
+                position = pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+        producerBlocked = true;
+    }
+    return false;
+}
+
+void CommandQueue :: signal() {
+    const uint64_t one = 1;
+    if (write(eventFd, &one, sizeof(one)) < 0) {
+        // The counter is already non-zero, the consumer wakes up anyway
+    }
+}
+
+const QueuedCommand* CommandQueue :: front() const {
+    const Slot& slot = slots[popPosition & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != popPosition + 1) {
+        return nullptr;
+    }
+    return &slot.command;
+}
+
+bool CommandQueue :: pop() {
+    Slot& slot = slots[popPosition & mask];
+    slot.sequence.store(popPosition + mask + 1);
+    popPosition++;
+    return producerBlocked.exchange(false);
+}
+
+void CommandQueue :: wait(int64_t timeoutMicros) {
+    pollfd pfd;
+    pfd.fd = eventFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    timespec timeout;
+    timeout.tv_sec = timeoutMicros / 1000000;
+    timeout.tv_nsec = (timeoutMicros % 1000000) * 1000;
+    if (ppoll(&pfd, 1, &timeout, nullptr) > 0) {
+        uint64_t value;
+        if (read(eventFd, &value, sizeof(value)) < 0) {
+            // Nothing to do, the counter is only used to wake up
+        }
+    }
+}
+
+CommandQueue :: CommandQueue(size_t slotCount) : 
+    slots(new Slot[slotCount]), 
+    mask(slotCount - 1) 
+{
+    if ((slotCount == 0) || ((slotCount & mask) != 0)) {
+        throw CommandQueueCreationFailed("Slot count must be a power of two");
+    }
+    for (size_t i = 0; i < slotCount; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+        slots[i].command.connectionId = 0;
+        slots[i].command.line.reserve(COMMAND_SLOT_CAPACITY);
+    }
+    pushPosition = 0;
+    popPosition = 0;
+    producerBlocked = false;
+
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0) {
+        throw CommandQueueCreationFailed(strerror(errno));
+    }
+}
+
+CommandQueue :: ~CommandQueue() {
+    close(eventFd);
+}
@@ -0,0 +1,92 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <exception>
+
+#include <stdint.h>
+
+class CommandQueueCreationFailed : public std::exception {
+private:
+    std::string error;
+public:
+    CommandQueueCreationFailed(const std::string& error) : error(error) {}
+    CommandQueueCreationFailed(const CommandQueueCreationFailed& other) = default;
+
+    const char* what() const noexcept override {
+        return error.c_str();
+    }
+};
+
+static const size_t DEFAULT_COMMAND_QUEUE_SLOTS = 256;
+// Lines up to this length are copied into a slot without allocating
+static const size_t COMMAND_SLOT_CAPACITY = 1024;
+
+struct QueuedCommand {
+    uint64_t connectionId;
+    std::string line;
+};
+
+// Bounded lock-free queue of received command lines. Any number of threads
+// may push, a single thread pops. All slots and their line buffers are
+// allocated up front and reused. An eventfd lets the consumer sleep until
+// commands arrive.
+class CommandQueue {
+private:
+    struct alignas(64) Slot {
+        // Equal to the push position while free, push position + 1 while
+        // it holds a command
+        std::atomic<size_t> sequence;
+        QueuedCommand command;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    const size_t mask;
+
+    alignas(64) std::atomic<size_t> pushPosition;
+    alignas(64) size_t popPosition;
+    // Set by a producer that found the queue full
+    std::atomic<bool> producerBlocked;
+
+    int eventFd;
+public:
+    // slotCount must be a power of two
+    CommandQueue(size_t slotCount = DEFAULT_COMMAND_QUEUE_SLOTS);
+    ~CommandQueue();
+
+    CommandQueue(const CommandQueue& other) = delete;
+    CommandQueue& operator=(const CommandQueue& other) = delete;
+
+    // Copies the line into a free slot. Returns false if the queue is full,
+    // the producer should retry after the consumer popped.
+    bool push(uint64_t connectionId, std::string_view line);
+    // Wakes up the consumer. Producers call this once after pushing a batch.
+    void signal();
+
+    // Consumer only. Returns the oldest command or nullptr if the queue is
+    // empty. The command stays valid until pop.
+    const QueuedCommand* front() const;
+    // Consumer only. Frees the front slot. Returns true if a producer found
+    // the queue full since the last call and should be told to retry.
+    bool pop();
+    // Consumer only. Sleeps until signal was called or the timeout passed.
+    void wait(int64_t timeoutMicros);
+};
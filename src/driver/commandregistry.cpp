@@ -0,0 +1,211 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#include "commandregistry.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <stdexcept>
+
+CommandReply& CommandReply :: field(int64_t value) {
+    char buffer[24];
+    const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return field(std::string_view(buffer, result.ptr - buffer));
+}
+
+static bool isChoice(const std::string& choices, std::string_view value) {
+    size_t start = 0;
+    while (start <= choices.size()) {
+        size_t end = choices.find('|', start);
+        if (end == std::string::npos) {
+            end = choices.size();
+        }
+        if (std::string_view(choices).substr(start, end - start) == value) {
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+bool CommandRegistry :: validate(const CommandSpec& spec, const CommandArguments& arguments, CommandReply& reply) const {
+    size_t required = 0;
+    for (const ParameterSpec& parameter : spec.parameters) {
+        required += parameter.optional ? 0 : 1;
+    }
+    if ((arguments.size() < required) || (arguments.size() > spec.parameters.size())) {
+        reply.error("Invalid parameter count");
+        return false;
+    }
+
+    for (size_t i = 0; i < arguments.size(); i++) {
+        const ParameterSpec& parameter = spec.parameters[i];
+        if (parameter.type == ParameterType::Integer) {
+            try {
+                parseLongLong(arguments[i]);
+            }
+            catch (const std::exception& e) {
+                reply.error("Invalid parameter");
+                return false;
+            }
+        }
+        if (!parameter.choices.empty() && !isChoice(parameter.choices, arguments[i])) {
+            reply.error("Invalid parameter");
+            return false;
+        }
+    }
+    return true;
+}
+
+void CommandRegistry :: help(const CommandArguments& arguments, CommandReply& reply) const {
+    if (arguments.empty()) {
+        std::vector<std::string_view> names;
+        for (auto& entry : commands) {
+            names.push_back(entry.first);
+        }
+        std::sort(names.begin(), names.end());
+
+        reply.ok();
+        for (std::string_view name : names) {
+            reply.field(name);
+        }
+        return;
+    }
+
+    auto found = commands.find(arguments[0]);
+    if (found == commands.end()) {
+        reply.error("Invalid command");
+        return;
+    }
+    const CommandSpec& spec = *found->second;
+
+    reply.ok().field(spec.name).field(spec.description);
+    for (const ParameterSpec& parameter : spec.parameters) {
+        std::string description = parameter.optional 
+            ? "[" + parameter.name + "]" 
+            : parameter.name;
+        description += "=";
+        if (!parameter.choices.empty()) {
+            description += parameter.choices;
+        } else {
+            description += (parameter.type == ParameterType::Integer) ? "int" : "string";
+        }
+        reply.field(description);
+    }
+}
+
+void CommandRegistry :: insert(std::unique_ptr<CommandSpec> spec) {
+    spec->statistics = &statistics[spec->name];
+    commands.erase(spec->name);
+    const std::string_view key = spec->name;
+    commands[key] = std::move(spec);
+}
+
+void CommandRegistry :: add(
+    const std::string& group,
+    const std::string& name,
+    const std::string& description,
+    const std::vector<ParameterSpec>& parameters,
+    CommandHandler handler
+) {
+    insert(std::unique_ptr<CommandSpec>(
+        new CommandSpec{group, name, description, parameters, handler, false, nullptr, nullptr}
+    ));
+}
+
+void CommandRegistry :: addSetting(
+    const std::string& group,
+    const std::string& name,
+    const std::string& description,
+    const std::vector<ParameterSpec>& parameters,
+    CommandHandler validator,
+    CommandHandler handler
+) {
+    insert(std::unique_ptr<CommandSpec>(
+        new CommandSpec{group, name, description, parameters, handler, true, validator, nullptr}
+    ));
+}
+
+void CommandRegistry :: run(const CommandSpec& spec, const CommandArguments& arguments, CommandReply& reply) const {
+    if (!validate(spec, arguments, reply)) {
+        return;
+    }
+    if (spec.validator) {
+        spec.validator(arguments, reply);
+        if (reply.isError()) {
+            return;
+        }
+    }
+    spec.handler(arguments, reply);
+    if (!reply.written()) {
+        reply.ok();
+    }
+}
+
+void CommandRegistry :: dispatch(std::string_view name, const CommandArguments& arguments, CommandReply& reply) const {
+    auto found = commands.find(name);
+    if (found == commands.end()) {
+        unknownCommands++;
+        reply.error("Invalid command");
+        return;
+    }
+
+    const CommandSpec& spec = *found->second;
+    const auto start = std::chrono::steady_clock::now();
+    run(spec, arguments, reply);
+    spec.statistics->duration.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count()
+    );
+    if (reply.isError()) {
+        spec.statistics->errors++;
+    }
+}
+
+bool CommandRegistry :: check(std::string_view name, const CommandArguments& arguments, CommandReply& reply) const {
+    auto found = commands.find(name);
+    if (found == commands.end()) {
+        reply.error("Invalid command");
+        return false;
+    }
+
+    const CommandSpec& spec = *found->second;
+    if (!spec.setting) {
+        reply.error("Not a setting");
+        return false;
+    }
+    if (!validate(spec, arguments, reply)) {
+        return false;
+    }
+    if (spec.validator) {
+        spec.validator(arguments, reply);
+    }
+    return !reply.isError();
+}
+
+CommandRegistry :: CommandRegistry() : unknownCommands(0) {
+    add(
+        "registry",
+        "help",
+        "Lists all commands or describes the parameters of one command",
+        {{"command", ParameterType::String, "", true}},
+        [this](const CommandArguments& arguments, CommandReply& reply) {
+            help(arguments, reply);
+        }
+    );
+}
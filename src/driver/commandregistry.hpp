@@ -0,0 +1,224 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <map>
+
+#include <stdint.h>
+
+#include "stringtools.hpp"
+#include "latency.hpp"
+
+static const int MAX_COMMAND_ARGUMENTS = 16;
+
+// Parameters of a command. The views point into the receive buffers and
+// are only valid during the handler call.
+class CommandArguments {
+private:
+    std::string_view arguments[MAX_COMMAND_ARGUMENTS];
+    int count;
+public:
+    size_t size() const {
+        return count;
+    }
+    bool empty() const {
+        return count == 0;
+    }
+    std::string_view operator[](int index) const {
+        return arguments[index];
+    }
+    const std::string_view* begin() const {
+        return arguments;
+    }
+    const std::string_view* end() const {
+        return arguments + count;
+    }
+
+    // Only for parameters declared as ParameterType::Integer, which the
+    // registry validated before calling the handler
+    long long integer(int index) const {
+        return parseLongLong(arguments[index]);
+    }
+
+    bool push(std::string_view argument) {
+        if (count >= MAX_COMMAND_ARGUMENTS) {
+            return false;
+        }
+        arguments[count++] = argument;
+        return true;
+    }
+    void clear() {
+        count = 0;
+    }
+
+    CommandArguments() : count(0) {}
+};
+
+// Writes a reply directly into the output buffer of the connection that
+// sent the command. A handler that writes nothing replies "OK".
+class CommandReply {
+private:
+    std::string& out;
+    const size_t start;
+    bool failed;
+public:
+    const uint64_t connectionId;
+    // Sent along with the reply using SCM_RIGHTS if set
+    int passedFd;
+
+    bool written() const {
+        return out.size() > start;
+    }
+    bool isError() const {
+        return failed;
+    }
+    size_t size() const {
+        return out.size() - start;
+    }
+
+    CommandReply& ok() {
+        out.resize(start);
+        failed = false;
+        out += "OK";
+        return *this;
+    }
+    CommandReply& field(std::string_view value) {
+        out += ':';
+        out += value;
+        return *this;
+    }
+    CommandReply& field(int64_t value);
+    // Appends lines of text after the reply, announced by their length in
+    // bytes. The text must end with a newline, which also ends the reply.
+    CommandReply& block(std::string_view text) {
+        field((int64_t) text.size());
+        out += '\n';
+        out += text.substr(0, text.size() - 1);
+        return *this;
+    }
+    void error(std::string_view message) {
+        out.resize(start);
+        failed = true;
+        out += "ERROR:";
+        out += message;
+    }
+
+    CommandReply(std::string& out, uint64_t connectionId) 
+        : out(out), start(out.size()), failed(false), connectionId(connectionId), passedFd(-1) {}
+};
+
+enum class ParameterType {
+    Integer, String
+};
+
+struct ParameterSpec {
+    std::string name;
+    ParameterType type;
+    // Allowed values separated by '|', any value if empty
+    std::string choices;
+    // Optional parameters can only follow required ones
+    bool optional;
+};
+
+typedef std::function<void(const CommandArguments& arguments, CommandReply& reply)> CommandHandler;
+
+// Calls of a command since the driver started. Kept by name, so counts
+// do not restart when a command is registered again.
+struct CommandStatistics {
+    uint64_t errors;
+    // Checking the arguments and running the handler, in microseconds
+    LatencyHistogram duration;
+
+    CommandStatistics() : errors(0) {}
+};
+
+struct CommandSpec {
+    std::string group;
+    std::string name;
+    // Must not contain ':'
+    std::string description;
+    std::vector<ParameterSpec> parameters;
+    CommandHandler handler;
+
+    // Settings can be staged in a transaction and applied together
+    bool setting;
+    // Checks the arguments of a setting beyond their declaration, without
+    // side effects. Replies an error if they are invalid. Optional.
+    CommandHandler validator;
+
+    // Owned by the registry
+    CommandStatistics* statistics;
+};
+
+// Maps command names to handlers. Subsystems register their commands in
+// groups, registering a name again replaces its command.
+class CommandRegistry {
+private:
+    // Keys point into the names of the specs
+    std::unordered_map<std::string_view, std::unique_ptr<CommandSpec>> commands;
+    std::map<std::string, CommandStatistics> statistics;
+    mutable uint64_t unknownCommands;
+
+    void insert(std::unique_ptr<CommandSpec> spec);
+
+    bool validate(const CommandSpec& spec, const CommandArguments& arguments, CommandReply& reply) const;
+    void help(const CommandArguments& arguments, CommandReply& reply) const;
+    void run(const CommandSpec& spec, const CommandArguments& arguments, CommandReply& reply) const;
+public:
+    void add(
+        const std::string& group,
+        const std::string& name,
+        const std::string& description,
+        const std::vector<ParameterSpec>& parameters,
+        CommandHandler handler
+    );
+    // Adds a command that changes a setting. The handler only runs if the
+    // validator accepted the arguments.
+    void addSetting(
+        const std::string& group,
+        const std::string& name,
+        const std::string& description,
+        const std::vector<ParameterSpec>& parameters,
+        CommandHandler validator,
+        CommandHandler handler
+    );
+
+    // Checks the arguments against the declaration and runs the handler
+    void dispatch(std::string_view name, const CommandArguments& arguments, CommandReply& reply) const;
+    // Checks that the command is a setting and its arguments are valid
+    // without running it. Returns false after replying an error.
+    bool check(std::string_view name, const CommandArguments& arguments, CommandReply& reply) const;
+
+    // By command name
+    const std::map<std::string, CommandStatistics>& getStatistics() const {
+        return statistics;
+    }
+    // Calls of names that were not registered
+    uint64_t getUnknownCommands() const {
+        return unknownCommands;
+    }
+
+    CommandRegistry();
+    CommandRegistry(const CommandRegistry& other) = delete;
+    CommandRegistry& operator=(const CommandRegistry& other) = delete;
+};
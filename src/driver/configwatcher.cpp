@@ -0,0 +1,87 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#include "configwatcher.hpp"
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+
+bool ConfigWatcher :: readEvents() {
+    alignas(struct inotify_event) char buffer[4096];
+
+    bool fileChanged = false;
+    while (true) {
+        const ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < length;) {
+            const struct inotify_event* event = (const struct inotify_event*) (buffer + offset);
+            if ((event->len > 0) && (fileName == event->name)) {
+                fileChanged = true;
+            }
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return fileChanged;
+}
+
+bool ConfigWatcher :: pollChanged() {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < nextCheck) {
+        return false;
+    }
+    nextCheck = now + CONFIG_WATCH_INTERVAL;
+
+    if (readEvents()) {
+        changePending = true;
+        return false;
+    }
+    if (changePending) {
+        changePending = false;
+        return true;
+    }
+    return false;
+}
+
+ConfigWatcher :: ConfigWatcher(const std::string& filePath) : changePending(false) {
+    std::string directory = ".";
+    fileName = filePath;
+    const size_t slash = filePath.find_last_of('/');
+    if (slash != std::string::npos) {
+        directory = slash == 0 ? "/" : filePath.substr(0, slash);
+        fileName = filePath.substr(slash + 1);
+    }
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        throw ConfigWatcherCreationFailed(strerror(errno));
+    }
+    if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        const std::string error = strerror(errno);
+        close(inotifyFd);
+        throw ConfigWatcherCreationFailed(error);
+    }
+    nextCheck = std::chrono::steady_clock::now();
+}
+
+ConfigWatcher :: ~ConfigWatcher() {
+    close(inotifyFd);
+}
@@ -0,0 +1,63 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <exception>
+
+class ConfigWatcherCreationFailed : public std::exception {
+private:
+    std::string error;
+public:
+    ConfigWatcherCreationFailed(const std::string& error) : error(error) {}
+    ConfigWatcherCreationFailed(const ConfigWatcherCreationFailed& other) = default;
+
+    const char* what() const noexcept override {
+        return error.c_str();
+    }
+};
+
+// How often pollChanged looks for file events. A change is reported once
+// no further events arrived for a whole interval, so editors that write a
+// file in several steps trigger a single reload.
+static const std::chrono::milliseconds CONFIG_WATCH_INTERVAL(250);
+
+// Watches a single file for modifications using inotify. The directory of
+// the file is watched, so files replaced by rename (as most editors do)
+// are still seen.
+class ConfigWatcher {
+private:
+    std::string fileName;
+    int inotifyFd;
+
+    std::chrono::steady_clock::time_point nextCheck;
+    bool changePending;
+
+    // Reads all queued events without blocking, true if any of them
+    // concerned the file
+    bool readEvents();
+public:
+    // Cheap to call every frame, returns true once per settled change
+    bool pollChanged();
+
+    ConfigWatcher(const std::string& filePath);
+    ~ConfigWatcher();
+
+    ConfigWatcher(const ConfigWatcher& other) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher& other) = delete;
+};
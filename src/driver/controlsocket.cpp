@@ -17,180 +17,961 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include "controlsocket.hpp"
 
 #include <iostream>
+#include <sstream>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
 
-#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "stringtools.hpp"
 
-void ConnectionHandler :: threadMain() {
-    char readbuffer[1024];
+// epoll user data of the two non-client file descriptors. Connection ids
+// start at 1.
+static const uint64_t ACCEPTOR_EVENT_ID = 0;
+static const uint64_t WAKEUP_EVENT_ID = UINT64_MAX;
 
-    struct pollfd polldata;
-    polldata.fd = socket.handle();
-    polldata.events = POLLERR | POLLIN | POLLPRI | POLLHUP;
+static const int READ_BUFFER_SIZE = 1024;
+static const int MAX_EPOLL_EVENTS = 32;
+static const int MAX_WRITE_BATCH = 64;
+
+const char* TELEMETRY_TOPIC_NAMES[(int) TelemetryTopic::COUNT] = {
+    "ir", "lr", "flr", "buttons", "accel", "cursor", "stats"
+};
+
+// Stats describe the frame itself and are sent for every frame
+static bool isChangeFilteredTopic(TelemetryTopic topic) {
+    return topic != TelemetryTopic::Stats;
+}
+
+static bool parseTelemetryTopic(std::string_view str, TelemetryTopic& topic) {
+    for (int i = 0; i < (int) TelemetryTopic::COUNT; i++) {
+        if (str == TELEMETRY_TOPIC_NAMES[i]) {
+            topic = (TelemetryTopic) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Splits "[#id:]name[:argument]..." into views of the line. Returns false
+// if there are more arguments than fit into arguments.
+static bool tokenizeCommand(
+    std::string_view line, 
+    std::string_view& requestId, 
+    std::string_view& name, 
+    CommandArguments& arguments
+) {
+    arguments.clear();
+    bool complete = true;
+    bool hasName = false;
+    size_t partStart = 0;
+    while (true) {
+        size_t partEnd = line.find(':', partStart);
+        if (partEnd == std::string_view::npos) {
+            partEnd = line.size();
+        }
+        const std::string_view part = line.substr(partStart, partEnd - partStart);
+
+        if ((partStart == 0) && !part.empty() && (part[0] == '#')) {
+            requestId = part.substr(1);
+        } else if (!hasName) {
+            name = part;
+            hasName = true;
+        } else if (!arguments.push(part)) {
+            complete = false;
+        }
+
+        if (partEnd == line.size()) {
+            break;
+        }
+        partStart = partEnd + 1;
+    }
+    return complete;
+}
+
+bool TopicValues :: differs(const TopicValues& other, int32_t threshold) const {
+    if ((flags != other.flags) || (count != other.count)) {
+        return true;
+    }
+    for (int i = 0; i < count; i++) {
+        if (std::abs((int64_t) values[i] - other.values[i]) > threshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseSlowConsumerPolicy(const std::string& str, SlowConsumerPolicy& policy) {
+    if (str == "drop_oldest") {
+        policy = SlowConsumerPolicy::DropOldest;
+    } else if (str == "drop_newest") {
+        policy = SlowConsumerPolicy::DropNewest;
+    } else if (str == "disconnect") {
+        policy = SlowConsumerPolicy::Disconnect;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Connection :: Connection(uint64_t id, int fd) : id(id), fd(fd) {
+    queuedBytes = 0;
+    frontOffset = 0;
+    droppedMessages = 0;
+    telemetryBytes = 0;
+    binaryTelemetry = false;
+    inBuffer.resize(2 * READ_BUFFER_SIZE);
+    inLength = 0;
+    for (TopicSubscription& topic : topics) {
+        topic.subscribed = false;
+        topic.minIntervalMicros = 0;
+        topic.nextDueMicros = 0;
+        topic.changeThreshold = 0;
+        topic.hasLastValues = false;
+        topic.nextKeyframeMicros = 0;
+    }
+    inTransaction = false;
+    transactionFailed = false;
+    writeWatched = false;
+    readPaused = false;
+    readClosed = false;
+    queuedCommands = 0;
+    failed = false;
+}
+
+Connection :: ~Connection() {
+    for (const OutgoingMessage& message : outQueue) {
+        if (message.passedFd >= 0) {
+            close(message.passedFd);
+        }
+    }
+    close(fd);
+}
+
+void ControlSocket :: threadMain() {
+    epoll_event events[MAX_EPOLL_EVENTS];
 
     while (alive) {
-        polldata.revents = 0;
-        int pollres = poll(&polldata, 1, 500);
-        if (polldata.revents || pollres) {
-            if (polldata.revents & POLLIN) {
-                const int readn = socket.read_n(readbuffer, 1024);
-                if (readn < 0) {
-                    std::cout << "read failed" << std::endl;
-                } else if (readn > 0) {
-                    readbuffer[1024 - 1] = 0;
-                    if (readn < 1024) {
-                        readbuffer[readn] = 0;
-                    }
-
-                    const std::string messages(readbuffer);
-                    auto messageList = split(messages, '\n');
-                    for (std::string msg : messageList) {
-                        msg = trim(msg);
-                        if (!msg.length()) {
-                            continue;
-                        }
-
-                        auto parts = split(msg, ':');
-                        if (parts.size() < 1) {
-                            continue;
-                        }
-
-                        pushCommand(Command{
-                            parts[0],
-                            std::vector<std::string>(parts.begin() + 1, parts.end()),
-                            this
-                        });
-                    }
+        const int n = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            const uint64_t id = events[i].data.u64;
+            if (id == WAKEUP_EVENT_ID) {
+                uint64_t value;
+                if (read(wakeupFd, &value, sizeof(value)) < 0) {
+                    // Nothing to do, the counter is only used to wake up
                 }
+                // Either shutdown or the command queue has room again
+                std::lock_guard<std::mutex> lock(sharedResourceMutex);
+                resumePausedConnections();
+                continue;
+            }
+            if (id == ACCEPTOR_EVENT_ID) {
+                acceptConnections();
+                continue;
             }
-            if (polldata.revents & POLLHUP) {
-                alive = false;
-                socket.close();
+
+            std::lock_guard<std::mutex> lock(sharedResourceMutex);
+            auto found = connections.find(id);
+            if (found == connections.end()) {
                 continue;
             }
+            Connection& connection = *found->second;
+
+            if (events[i].events & EPOLLIN) {
+                readConnection(connection);
+            }
+            if ((events[i].events & EPOLLOUT) && !connection.failed) {
+                writeConnection(connection);
+            }
+            if (connection.failed || connection.finished() || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                closeConnection(id);
+            }
         }
 
-        if (!socket.is_open()) {
-            alive = false;
+        if (commandsPushed) {
+            commandsPushed = false;
+            commandQueue.signal();
         }
     }
 }
 
-bool ConnectionHandler :: isAlive() const {
-    return alive && thread.joinable() && socket.is_open();
-}
+void ControlSocket :: acceptConnections() {
+    while (true) {
+        const int fd = accept4(acceptor->handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                std::cerr << "accept failed: " << strerror(errno) << std::endl;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(sharedResourceMutex);
+        const uint64_t id = nextConnectionId++;
 
-void ConnectionHandler :: sendMessage(const std::string& msg) {
-    int msgLen = msg.length();
-    if (msgLen > 1024) {
-        msgLen = 1024;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = id;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            std::cerr << "Failed to watch connection: " << strerror(errno) << std::endl;
+            close(fd);
+            continue;
+        }
+        connections[id] = std::unique_ptr<Connection>(new Connection(id, fd));
     }
-    socket.write_n(msg.c_str(), msgLen);
 }
 
-void ConnectionHandler :: startShutdown() {
-    alive = false;
+void ControlSocket :: readConnection(Connection& connection) {
+    while (true) {
+        if (connection.inBuffer.size() - connection.inLength < READ_BUFFER_SIZE) {
+            if (connection.inBuffer.size() >= MAX_COMMAND_LINE_LENGTH) {
+                connection.failed = true;
+                return;
+            }
+            connection.inBuffer.resize(connection.inBuffer.size() * 2);
+        }
+
+        const ssize_t readn = read(
+            connection.fd, 
+            connection.inBuffer.data() + connection.inLength, 
+            connection.inBuffer.size() - connection.inLength
+        );
+        if (readn < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            connection.failed = true;
+            return;
+        }
+        if (readn == 0) {
+            // Orderly shutdown by the client. Replies to the commands it
+            // sent are still written.
+            connection.readClosed = true;
+            updateWatch(connection);
+            return;
+        }
+
+        connection.inLength += readn;
+        extractLines(connection);
+        if (connection.readPaused) {
+            updateWatch(connection);
+            return;
+        }
+    }
 }
 
-ConnectionHandler :: ConnectionHandler(
-    sockpp::unix_socket& _socket,
-    PushCommandFunction _pushCommand
-) : socket(_socket.release()), pushCommand(_pushCommand) {
-    alive = true;
-    thread = std::thread(&ConnectionHandler::threadMain, this);
+void ControlSocket :: extractLines(Connection& connection) {
+    const char* data = connection.inBuffer.data();
+    size_t lineStart = 0;
+    for (size_t i = 0; i < connection.inLength; i++) {
+        if (data[i] != '\n') {
+            continue;
+        }
+        const std::string_view line = trimView(std::string_view(data + lineStart, i - lineStart));
+        if (!line.empty()) {
+            if (!commandQueue.push(connection.id, line)) {
+                connection.readPaused = true;
+                break;
+            }
+            connection.queuedCommands++;
+            commandsPushed = true;
+        }
+        lineStart = i + 1;
+    }
+
+    // Keeps the incomplete last line for the next read
+    if (lineStart > 0) {
+        memmove(connection.inBuffer.data(), data + lineStart, connection.inLength - lineStart);
+        connection.inLength -= lineStart;
+    }
 }
 
-ConnectionHandler :: ~ConnectionHandler() {
-    startShutdown();
-    thread.join();
+void ControlSocket :: resumePausedConnections() {
+    for (auto& entry : connections) {
+        Connection& connection = *entry.second;
+        if (!connection.readPaused || connection.failed) {
+            continue;
+        }
+        connection.readPaused = false;
+        extractLines(connection);
+        if (connection.readPaused) {
+            // Still full, the next pop wakes this thread again
+            break;
+        }
+        updateWatch(connection);
+    }
+    if (commandsPushed) {
+        commandsPushed = false;
+        commandQueue.signal();
+    }
 }
 
-void ControlSocket :: threadMain() {
-    struct pollfd polldata;
-    polldata.fd = acceptor->handle();
-    polldata.events = POLLERR | POLLIN | POLLPRI | POLLHUP;
+void ControlSocket :: writeConnection(Connection& connection) {
+    while (!connection.outQueue.empty() && !connection.failed) {
+        iovec iov[MAX_WRITE_BATCH];
+        int iovCount = 0;
+        for (const OutgoingMessage& message : connection.outQueue) {
+            // Passed descriptors travel with the first byte of a sendmsg,
+            // so such a message always starts a new batch
+            if ((iovCount >= MAX_WRITE_BATCH) || ((iovCount > 0) && (message.passedFd >= 0))) {
+                break;
+            }
+            const size_t offset = (iovCount == 0) ? connection.frontOffset : 0;
+            iov[iovCount].iov_base = (void*) (message.data.data() + offset);
+            iov[iovCount].iov_len = message.data.size() - offset;
+            iovCount++;
+        }
 
-    while (alive) {
-        polldata.revents = 0;
-        int pollres = poll(&polldata, 1, 50);
-        if (polldata.revents || pollres) {
-            if (polldata.revents & POLLHUP) {
-                alive = false;
-                acceptor->close();
+        msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = iov;
+        header.msg_iovlen = iovCount;
+
+        OutgoingMessage& front = connection.outQueue.front();
+        union {
+            char buffer[CMSG_SPACE(sizeof(int))];
+            cmsghdr align;
+        } control;
+        if (front.passedFd >= 0) {
+            memset(&control, 0, sizeof(control));
+            header.msg_control = control.buffer;
+            header.msg_controllen = sizeof(control.buffer);
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &front.passedFd, sizeof(int));
+        }
+
+        ssize_t written = sendmsg(connection.fd, &header, MSG_NOSIGNAL);
+        if (written < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (errno == EINTR) {
                 continue;
-            } else if (sockpp::unix_socket sock = acceptor->accept()) {
-                std::lock_guard<std::mutex> lock(sharedResourceMutex);
+            }
+            connection.failed = true;
+            break;
+        }
+        if ((written > 0) && (front.passedFd >= 0)) {
+            close(front.passedFd);
+            front.passedFd = -1;
+        }
 
-                std::vector<ConnectionHandler*> toRemove;
-                for (ConnectionHandler* ht : handlerThreads) {
-                    if (!ht->isAlive()) {
-                        toRemove.push_back(ht);
-                    }
-                }
-                for (ConnectionHandler* ht : toRemove) {
-                    handlerThreads.erase(
-                        std::find(handlerThreads.begin(), handlerThreads.end(), ht)
-                    );
-                    delete ht;
+        connection.queuedBytes -= written;
+        while (written > 0) {
+            const size_t remaining = connection.outQueue.front().data.size() - connection.frontOffset;
+            if ((size_t) written < remaining) {
+                connection.frontOffset += written;
+                break;
+            }
+            written -= remaining;
+            connection.frontOffset = 0;
+            connection.outQueue.pop_front();
+        }
+    }
+    watchWrites(connection, !connection.outQueue.empty() && !connection.failed);
+}
+
+void ControlSocket :: watchWrites(Connection& connection, bool enable) {
+    if (connection.writeWatched == enable) {
+        return;
+    }
+    connection.writeWatched = enable;
+    updateWatch(connection);
+}
+
+void ControlSocket :: updateWatch(Connection& connection) {
+    // Hangups of paused connections are noticed when reading resumes
+    epoll_event ev;
+    ev.events = ((connection.readPaused || connection.readClosed) ? 0 : EPOLLIN | EPOLLRDHUP) 
+        | (connection.writeWatched ? EPOLLOUT : 0);
+    ev.data.u64 = connection.id;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &ev);
+}
+
+void ControlSocket :: closeConnection(uint64_t id) {
+    auto found = connections.find(id);
+    if (found == connections.end()) {
+        return;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, found->second->fd, nullptr);
+    connections.erase(found);
+}
+
+void ControlSocket :: closeFinishedConnections() {
+    std::vector<uint64_t> closedIds;
+    for (auto& entry : connections) {
+        if (entry.second->failed || entry.second->finished()) {
+            closedIds.push_back(entry.first);
+        }
+    }
+    for (uint64_t id : closedIds) {
+        closeConnection(id);
+    }
+}
+
+bool ControlSocket :: makeRoom(Connection& connection, size_t size, bool droppable) {
+    if (connection.queuedBytes + size <= clientQueueLimit) {
+        return true;
+    }
+
+    if (!droppable) {
+        if (connection.queuedBytes + size > clientQueueLimit * REPLY_QUEUE_LIMIT_FACTOR) {
+            connection.failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    switch (slowConsumerPolicy) {
+        case SlowConsumerPolicy::DropOldest: {
+            // The partially written head of the queue must be completed,
+            // everything else that is droppable can go
+            auto it = connection.outQueue.begin();
+            if ((it != connection.outQueue.end()) && (connection.frontOffset > 0)) {
+                it++;
+            }
+            while ((it != connection.outQueue.end()) && (connection.queuedBytes + size > clientQueueLimit)) {
+                if (it->droppable) {
+                    connection.queuedBytes -= it->data.size();
+                    connection.droppedMessages++;
+                    it = connection.outQueue.erase(it);
+                } else {
+                    it++;
                 }
+            }
+            if (connection.queuedBytes + size <= clientQueueLimit) {
+                return true;
+            }
+            connection.droppedMessages++;
+            return false;
+        }
+        case SlowConsumerPolicy::DropNewest:
+            connection.droppedMessages++;
+            return false;
+        case SlowConsumerPolicy::Disconnect:
+            connection.failed = true;
+            return false;
+    }
+    return false;
+}
 
-                handlerThreads.push_back(new ConnectionHandler(
-                    sock,
-                    [this](const Command& command) {
-                        std::lock_guard<std::mutex> lock(sharedResourceMutex);
-                        commands.push_back(command);
-                    }
-                ));
+void ControlSocket :: queueMessage(Connection& connection, const std::string& msg, bool droppable, int passedFd) {
+    if (connection.failed || !makeRoom(connection, msg.size(), droppable)) {
+        if (passedFd >= 0) {
+            close(passedFd);
+        }
+        return;
+    }
+    connection.outQueue.push_back(OutgoingMessage{msg, droppable, passedFd});
+    connection.queuedBytes += msg.size();
+    if (droppable) {
+        connection.telemetryBytes += msg.size();
+    }
+}
+
+void ControlSocket :: flushConnections() {
+    for (auto& entry : connections) {
+        Connection& connection = *entry.second;
+        // Connections waiting for EPOLLOUT are flushed by the event loop
+        if (!connection.outQueue.empty() && !connection.writeWatched) {
+            writeConnection(connection);
+        }
+    }
+    closeFinishedConnections();
+}
+
+void ControlSocket :: clientStatistics(CommandReply& reply) const {
+    reply.ok().field((int64_t) connections.size());
+    std::string entry;
+    for (const auto& pair : connections) {
+        const Connection& connection = *pair.second;
+        entry = std::to_string(connection.id) 
+            + "," + std::to_string(connection.queuedBytes) 
+            + "," + std::to_string(connection.droppedMessages);
+        reply.field(entry);
+    }
+}
+
+void ControlSocket :: writeMetrics(OpenMetricsWriter& writer) const {
+    writer.family("clients", "gauge", "Connected control socket clients");
+    writer.sample("clients", "", "", (uint64_t) connections.size());
+    writer.family("client_connects", "counter", "Control socket connections accepted");
+    writer.sample("client_connects", "_total", "", nextConnectionId - 1);
+
+    std::string labels;
+    writer.family("client_telemetry_bytes", "counter", "Telemetry bytes queued for a client", "bytes");
+    for (const auto& pair : connections) {
+        labels.clear();
+        appendMetricLabel(labels, "client", std::to_string(pair.first));
+        writer.sample("client_telemetry_bytes", "_total", labels, pair.second->telemetryBytes);
+    }
+    writer.family("client_dropped_messages", "counter", "Telemetry messages dropped because a client read too slowly");
+    for (const auto& pair : connections) {
+        labels.clear();
+        appendMetricLabel(labels, "client", std::to_string(pair.first));
+        writer.sample("client_dropped_messages", "_total", labels, pair.second->droppedMessages);
+    }
+    writer.family("client_queued_bytes", "gauge", "Bytes waiting to be sent to a client", "bytes");
+    for (const auto& pair : connections) {
+        labels.clear();
+        appendMetricLabel(labels, "client", std::to_string(pair.first));
+        writer.sample("client_queued_bytes", "", labels, (uint64_t) pair.second->queuedBytes);
+    }
+
+    // Commands that were never called are left out
+    const auto& statistics = registry.getStatistics();
+    writer.family("command_duration_seconds", "summary", "Time spent running a command", "seconds");
+    for (const auto& entry : statistics) {
+        if (entry.second.duration.getCount() == 0) {
+            continue;
+        }
+        labels.clear();
+        appendMetricLabel(labels, "command", entry.first);
+        writer.summary("command_duration_seconds", labels, entry.second.duration);
+    }
+    writer.family("command_errors", "counter", "Commands that replied an error");
+    for (const auto& entry : statistics) {
+        if (entry.second.duration.getCount() == 0) {
+            continue;
+        }
+        labels.clear();
+        appendMetricLabel(labels, "command", entry.first);
+        writer.sample("command_errors", "_total", labels, entry.second.errors);
+    }
+    writer.family("unknown_commands", "counter", "Commands with a name that is not registered");
+    writer.sample("unknown_commands", "_total", "", registry.getUnknownCommands());
+}
+
+void ControlSocket :: setTelemetryMode(Connection& connection, const CommandArguments& parameters, CommandReply& reply) {
+    connection.binaryTelemetry = parameters[0] == "binary";
+    reply.ok().field(parameters[0]);
+}
+
+void ControlSocket :: subscribe(Connection& connection, const CommandArguments& parameters, bool enable) {
+    TelemetryTopic topic;
+    parseTelemetryTopic(parameters[0], topic);
+
+    const int64_t maxRate = (parameters.size() >= 2) ? parameters.integer(1) : 0;
+
+    TopicSubscription& subscription = connection.topics[(int) topic];
+    subscription.subscribed = enable;
+    subscription.minIntervalMicros = (maxRate > 0) ? 1000000 / maxRate : 0;
+    subscription.nextDueMicros = 0;
+    subscription.changeThreshold = (parameters.size() >= 3) 
+        ? (int32_t) parameters.integer(2) 
+        : defaultChangeThreshold;
+    subscription.hasLastValues = false;
+    subscription.nextKeyframeMicros = 0;
+}
+
+void ControlSocket :: openTelemetryRing(CommandReply& reply) {
+    if (!telemetryRing) {
+        reply.error("Telemetry ring not available");
+        return;
+    }
+    reply.passedFd = telemetryRing->openReadOnly();
+    if (reply.passedFd < 0) {
+        reply.error(strerror(errno));
+        return;
+    }
+    reply.ok()
+        .field((int64_t) telemetryRing->getSlotCount())
+        .field((int64_t) telemetryRing->getRecordSize());
+}
+
+// Commands that control the transaction are never staged
+static bool isTransactionCommand(std::string_view name) {
+    return (name == "begin") || (name == "commit") || (name == "abort");
+}
+
+void ControlSocket :: stageCommand(Connection& connection, std::string_view line, std::string_view name, CommandReply& reply) {
+    if (connection.stagedCommands.size() >= MAX_TRANSACTION_COMMANDS) {
+        reply.error("Transaction too large");
+    } else if (registry.check(name, commandArguments, reply)) {
+        connection.stagedCommands.emplace_back(line);
+        reply.ok();
+        return;
+    }
+    // Commit fails as a whole, but later commands are still checked so
+    // that the client learns about all problems at once
+    connection.transactionFailed = true;
+}
+
+void ControlSocket :: beginTransaction(Connection& connection, CommandReply& reply) {
+    if (connection.inTransaction) {
+        reply.error("Transaction already open");
+        return;
+    }
+    connection.inTransaction = true;
+    connection.transactionFailed = false;
+    connection.stagedCommands.clear();
+}
+
+void ControlSocket :: commitTransaction(Connection& connection, CommandReply& reply) {
+    if (!connection.inTransaction) {
+        reply.error("No transaction");
+        return;
+    }
+    connection.inTransaction = false;
+    if (connection.transactionFailed) {
+        connection.stagedCommands.clear();
+        reply.error("Transaction contains invalid commands");
+        return;
+    }
+
+    // Staging checked each command against the state back then. Checks
+    // them all again so that nothing is applied if anything changed since.
+    CommandArguments arguments;
+    std::string stagedOut;
+    for (const std::string& line : connection.stagedCommands) {
+        std::string_view requestId;
+        std::string_view name;
+        tokenizeCommand(line, requestId, name, arguments);
+
+        stagedOut.clear();
+        CommandReply stagedReply(stagedOut, connection.id);
+        if (!registry.check(name, arguments, stagedReply)) {
+            reply.error("Transaction no longer valid at " + std::string(name));
+            connection.stagedCommands.clear();
+            return;
+        }
+    }
+
+    // Runs between two frames like every command, so the mouse never
+    // moves with only part of the settings applied
+    for (const std::string& line : connection.stagedCommands) {
+        std::string_view requestId;
+        std::string_view name;
+        tokenizeCommand(line, requestId, name, arguments);
+
+        stagedOut.clear();
+        CommandReply stagedReply(stagedOut, connection.id);
+        registry.dispatch(name, arguments, stagedReply);
+        if (stagedReply.isError()) {
+            // Only possible if a setting depends on another staged
+            // setting, the settings before were applied
+            reply.error("Failed to apply " + std::string(name));
+            connection.stagedCommands.clear();
+            return;
+        }
+    }
+    reply.ok().field((int64_t) connection.stagedCommands.size());
+    connection.stagedCommands.clear();
+}
+
+void ControlSocket :: abortTransaction(Connection& connection, CommandReply& reply) {
+    if (!connection.inTransaction) {
+        reply.error("No transaction");
+        return;
+    }
+    connection.inTransaction = false;
+    connection.stagedCommands.clear();
+}
+
+void ControlSocket :: registerCommands() {
+    // Socket commands act on the connection that sent them. They are only
+    // called from processEvents, which holds the mutex.
+    auto withConnection = [this](
+        std::function<void(Connection&, const CommandArguments&, CommandReply&)> handler
+    ) {
+        return [this, handler](const CommandArguments& arguments, CommandReply& reply) {
+            auto found = connections.find(reply.connectionId);
+            if (found != connections.end()) {
+                handler(*found->second, arguments, reply);
             }
+        };
+    };
 
+    std::string topics;
+    for (const char* topic : TELEMETRY_TOPIC_NAMES) {
+        topics += std::string(topics.empty() ? "" : "|") + topic;
+    }
+
+    registry.add(
+        "socket", "clients", 
+        "Lists the connected clients with their queued bytes and dropped messages",
+        {},
+        [this](const CommandArguments& arguments, CommandReply& reply) {
+            clientStatistics(reply);
+        }
+    );
+    registry.add(
+        "socket", "subscribe", 
+        "Sends a telemetry topic to this connection at most maxrate times per second "
+            "and only when it moved by more than threshold",
+        {
+            {"topic", ParameterType::String, topics, false},
+            {"maxrate", ParameterType::Integer, "", true},
+            {"threshold", ParameterType::Integer, "", true}
+        },
+        withConnection([this](Connection& connection, const CommandArguments& arguments, CommandReply& reply) {
+            for (size_t i = 1; i < arguments.size(); i++) {
+                if ((arguments.integer(i) < 0) || (arguments.integer(i) > INT32_MAX)) {
+                    reply.error("Invalid parameter");
+                    return;
+                }
+            }
+            subscribe(connection, arguments, true);
+        })
+    );
+    registry.add(
+        "socket", "unsubscribe", 
+        "Stops sending a telemetry topic to this connection",
+        {{"topic", ParameterType::String, topics, false}},
+        withConnection([this](Connection& connection, const CommandArguments& arguments, CommandReply& reply) {
+            subscribe(connection, arguments, false);
+        })
+    );
+    registry.add(
+        "socket", "telemetry", 
+        "Selects the telemetry format of this connection",
+        {{"format", ParameterType::String, "ascii|binary", false}},
+        withConnection([this](Connection& connection, const CommandArguments& arguments, CommandReply& reply) {
+            setTelemetryMode(connection, arguments, reply);
+        })
+    );
+    registry.add(
+        "socket", "begin", 
+        "Starts a transaction. Settings sent until commit are checked and staged",
+        {},
+        withConnection([this](Connection& connection, const CommandArguments& arguments, CommandReply& reply) {
+            beginTransaction(connection, reply);
+        })
+    );
+    registry.add(
+        "socket", "commit", 
+        "Applies all staged settings together and returns their number",
+        {},
+        withConnection([this](Connection& connection, const CommandArguments& arguments, CommandReply& reply) {
+            commitTransaction(connection, reply);
+        })
+    );
+    registry.add(
+        "socket", "abort", 
+        "Discards all staged settings",
+        {},
+        withConnection([this](Connection& connection, const CommandArguments& arguments, CommandReply& reply) {
+            abortTransaction(connection, reply);
+        })
+    );
+    registry.add(
+        "socket", "telemetryring", 
+        "Passes a read-only descriptor of the shared memory telemetry ring",
+        {},
+        [this](const CommandArguments& arguments, CommandReply& reply) {
+            openTelemetryRing(reply);
         }
+    );
+}
+
+std::string& ControlSocket :: replyBuffer(Connection& connection) {
+    if (connection.outQueue.empty() 
+        || connection.outQueue.back().droppable 
+        || (connection.outQueue.back().passedFd >= 0)
+    ) {
+        connection.outQueue.push_back(OutgoingMessage{std::string(), false, -1});
     }
+    return connection.outQueue.back().data;
 }
 
-void ControlSocket :: processEvents(CommandHandleFunction handler) {
-    std::lock_guard<std::mutex> lock(sharedResourceMutex);
-    if (commands.size() == 0) {
+void ControlSocket :: processEvents() {
+    const QueuedCommand* command = commandQueue.front();
+    if (!command) {
         return;
     }
-    
-    for (Command command : commands) {
-        auto found = std::find(handlerThreads.begin(), handlerThreads.end(), command.handler);
-        if ((found == handlerThreads.end()) || (!(*found)->isAlive())) {
-            continue;
+
+    std::lock_guard<std::mutex> lock(sharedResourceMutex);
+    bool producerBlocked = false;
+    for (; command; command = commandQueue.front()) {
+        runCommand(*command);
+        producerBlocked |= commandQueue.pop();
+    }
+    if (producerBlocked) {
+        const uint64_t one = 1;
+        if (write(wakeupFd, &one, sizeof(one)) < 0) {
+            std::cerr << "Failed to wake up control socket thread" << std::endl;
         }
+    }
+    flushConnections();
+}
+
+void ControlSocket :: waitForCommands(int64_t timeoutMicros) {
+    commandQueue.wait(timeoutMicros);
+}
 
-        std::string result = handler(command.name, command.parameters);
-        try {
-            command.handler->sendMessage(result + "\n");
+void ControlSocket :: runCommand(const QueuedCommand& command) {
+    auto found = connections.find(command.connectionId);
+    if (found == connections.end()) {
+        return;
+    }
+    Connection& connection = *found->second;
+    connection.queuedCommands--;
+    if (connection.failed) {
+        return;
+    }
+
+    const std::string_view line(command.line);
+    std::string_view requestId;
+    std::string_view name;
+    const bool tooManyArguments = !tokenizeCommand(line, requestId, name, commandArguments);
+
+    std::string& out = replyBuffer(connection);
+    const size_t replyStart = out.size();
+    if (!requestId.empty()) {
+        out += '#';
+        out += requestId;
+        out += ':';
+    }
+    {
+        CommandReply reply(out, connection.id);
+        if (tooManyArguments) {
+            reply.error("Too many parameters");
+            connection.transactionFailed = true;
+        } else if (connection.inTransaction && !isTransactionCommand(name)) {
+            stageCommand(connection, line, name, reply);
+        } else {
+            registry.dispatch(name, commandArguments, reply);
         }
-        catch (const std::exception& e) {
-            // Please find out what the actual exception type is
-            std::cerr << "Error sending message: " << e.what() << std::endl;
+
+        if (reply.passedFd >= 0) {
+            // The descriptor travels with the first byte of its message,
+            // so the reply gets a message of its own
+            std::string text = out.substr(replyStart) + "\n";
+            out.resize(replyStart);
+            if (out.empty()) {
+                connection.outQueue.pop_back();
+            }
+            connection.queuedBytes += text.size();
+            connection.outQueue.push_back(OutgoingMessage{text, false, reply.passedFd});
+            return;
         }
     }
-    commands.clear();
+    out += '\n';
+    connection.queuedBytes += out.size() - replyStart;
+
+    // Clients that do not even read their replies are disconnected
+    if (connection.queuedBytes > clientQueueLimit * REPLY_QUEUE_LIMIT_FACTOR) {
+        connection.failed = true;
+    }
 }
 
 void ControlSocket :: broadcastMessage(const std::string& msg) {
     std::lock_guard<std::mutex> lock(sharedResourceMutex);
 
-    for (ConnectionHandler* ch : handlerThreads) {
-        try {
-            ch->sendMessage(msg);
+    for (auto& entry : connections) {
+        queueMessage(*entry.second, msg, true);
+    }
+    flushConnections();
+}
+
+void ControlSocket :: broadcastTelemetry(
+    const TelemetryTopicMessages& topicMessages, 
+    const TelemetryTopicValues& topicValues,
+    const std::string& binary, 
+    int64_t nowMicros
+) {
+    std::lock_guard<std::mutex> lock(sharedResourceMutex);
+
+    std::string frame;
+    for (auto& entry : connections) {
+        Connection& connection = *entry.second;
+
+        frame.clear();
+        bool anyDue = false;
+        for (int i = 0; i < (int) TelemetryTopic::COUNT; i++) {
+            TopicSubscription& subscription = connection.topics[i];
+            const std::string& message = topicMessages[i];
+            if (!subscription.subscribed || message.empty()) {
+                continue;
+            }
+            if (nowMicros < subscription.nextDueMicros) {
+                continue;
+            }
+            if (isChangeFilteredTopic((TelemetryTopic) i)) {
+                const TopicValues& values = topicValues[i];
+                const bool keyframe = nowMicros >= subscription.nextKeyframeMicros;
+                if (!keyframe 
+                    && subscription.hasLastValues 
+                    && !values.differs(subscription.lastValues, subscription.changeThreshold)
+                ) {
+                    continue;
+                }
+                if (keyframe) {
+                    subscription.nextKeyframeMicros = nowMicros + keyframeIntervalMicros;
+                }
+                subscription.lastValues = values;
+                subscription.hasLastValues = true;
+            }
+
+            // Keeps the average rate at the limit when frames jitter, but
+            // does not allow bursts after a pause
+            const int64_t base = (nowMicros - subscription.nextDueMicros > subscription.minIntervalMicros)
+                ? nowMicros 
+                : subscription.nextDueMicros;
+            subscription.nextDueMicros = base + subscription.minIntervalMicros;
+            anyDue = true;
+            if (!connection.binaryTelemetry) {
+                frame += message;
+            }
         }
-        catch (const std::exception& e) {
-            // Please find out what the actual exception type is
-            std::cerr << "Error sending message: " << e.what() << std::endl;
+
+        if (anyDue) {
+            queueMessage(connection, connection.binaryTelemetry ? binary : frame, true);
         }
     }
+    flushConnections();
+}
+
+void ControlSocket :: setTelemetryChangeFilter(int32_t defaultThreshold, int64_t keyframeIntervalMicros) {
+    std::lock_guard<std::mutex> lock(sharedResourceMutex);
+    defaultChangeThreshold = defaultThreshold;
+    this->keyframeIntervalMicros = keyframeIntervalMicros;
 }
 
-ControlSocket :: ControlSocket(std::string socketAddr) : socketAddr(socketAddr) {
+void ControlSocket :: shareTelemetryRing(TelemetryRing* ring) {
+    std::lock_guard<std::mutex> lock(sharedResourceMutex);
+    telemetryRing = ring;
+}
+
+ControlSocket :: ControlSocket(
+    std::string socketAddr, 
+    SlowConsumerPolicy slowConsumerPolicy,
+    size_t clientQueueLimit
+) : socketAddr(socketAddr), 
+    slowConsumerPolicy(slowConsumerPolicy), 
+    clientQueueLimit(clientQueueLimit) 
+{
     alive = true;
+    nextConnectionId = 1;
+    commandsPushed = false;
+    telemetryRing = nullptr;
+    defaultChangeThreshold = 0;
+    keyframeIntervalMicros = DEFAULT_TELEMETRY_KEYFRAME_INTERVAL_MICROS;
+    registerCommands();
     sockpp::initialize();
 
     acceptor = std::shared_ptr<sockpp::unix_acceptor>(new sockpp::unix_acceptor);
@@ -201,27 +982,40 @@ ControlSocket :: ControlSocket(std::string socketAddr) : socketAddr(socketAddr)
     if (!res) {
         throw SocketCreationFailed(acceptor->last_error_str());
     }
+    const int acceptorFd = acceptor->handle();
+    fcntl(acceptorFd, F_SETFL, fcntl(acceptorFd, F_GETFL) | O_NONBLOCK);
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((epollFd < 0) || (wakeupFd < 0)) {
+        throw SocketCreationFailed(strerror(errno));
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = ACCEPTOR_EVENT_ID;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, acceptorFd, &ev);
+    ev.data.u64 = WAKEUP_EVENT_ID;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &ev);
+
     mainThread = std::thread(&ControlSocket::threadMain, this);
 }
 
 ControlSocket :: ~ControlSocket() {
-    {
-        std::lock_guard<std::mutex> lock(sharedResourceMutex);
-        for (ConnectionHandler* h : handlerThreads) {
-            h->startShutdown();
-        }
-    }
     alive = false;
+    const uint64_t one = 1;
+    if (write(wakeupFd, &one, sizeof(one)) < 0) {
+        std::cerr << "Failed to wake up control socket thread" << std::endl;
+    }
+    mainThread.join();
 
     {
         std::lock_guard<std::mutex> lock(sharedResourceMutex);
-        for (ConnectionHandler* h : handlerThreads) {
-            delete h;
-        }
-        handlerThreads.clear();
+        connections.clear();
     }
 
-    mainThread.join();
+    close(wakeupFd);
+    close(epollFd);
 
     if (acceptor) {
         acceptor->close();
@@ -17,16 +17,27 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <deque>
 #include <functional>
 #include <exception>
 
+#include <stdint.h>
+
 #include "sockpp/unix_acceptor.h"
 #include "sockpp/version.h"
 
+#include "telemetryring.hpp"
+#include "commandregistry.hpp"
+#include "commandqueue.hpp"
+#include "metrics.hpp"
+
 class SocketFailed : public std::exception {};
 class SocketCreationFailed : public SocketFailed {
 private:
@@ -40,55 +51,231 @@ public:
     }
 };
 
-class ConnectionHandler;
+static constexpr char DEFAULT_SOCKET_ADDR[] = "./wiimote-mouse.sock";
+static const size_t DEFAULT_CLIENT_QUEUE_LIMIT = 64 * 1024;
+static const int64_t DEFAULT_TELEMETRY_KEYFRAME_INTERVAL_MICROS = 1000000;
 
-static const std::string DEFAULT_SOCKET_ADDR = "./wiimote-mouse.sock";
+// What happens to telemetry for a client whose send queue is full
+enum class SlowConsumerPolicy {
+    DropOldest,
+    DropNewest,
+    Disconnect
+};
 
-struct Command {
-    std::string name;
-    std::vector<std::string> parameters;
-    ConnectionHandler* handler;
+bool parseSlowConsumerPolicy(const std::string& str, SlowConsumerPolicy& policy);
+
+// Telemetry a client can subscribe to
+enum class TelemetryTopic {
+    Ir, Lr, Flr, Buttons, Accel, Cursor, Stats, COUNT
 };
 
-typedef std::function<std::string(const std::string& command, const std::vector<std::string>& parameters)> CommandHandleFunction;
-typedef std::function<void(const Command& command)> PushCommandFunction;
+extern const char* TELEMETRY_TOPIC_NAMES[(int) TelemetryTopic::COUNT];
 
-class ConnectionHandler {
-private:
-    bool alive;
-    sockpp::unix_socket socket;
-    PushCommandFunction pushCommand;
-    std::thread thread;
+// Per-frame ASCII messages, indexed by TelemetryTopic
+typedef std::string TelemetryTopicMessages[(int) TelemetryTopic::COUNT];
 
-    void threadMain();
+static const int MAX_TOPIC_VALUES = 8;
+
+// Numeric content of a topic message, used to decide whether it changed.
+// Flags (validity, button states) must match exactly, values may move by
+// the change threshold of a subscription.
+struct TopicValues {
+    uint32_t flags;
+    int count;
+    int32_t values[MAX_TOPIC_VALUES];
+
+    bool differs(const TopicValues& other, int32_t threshold) const;
+};
+
+typedef TopicValues TelemetryTopicValues[(int) TelemetryTopic::COUNT];
+
+struct TopicSubscription {
+    bool subscribed;
+    // 0 sends every frame
+    int64_t minIntervalMicros;
+    int64_t nextDueMicros;
+
+    // Values of the last message sent. A topic is only sent again when it
+    // moved by more than changeThreshold or a keyframe is due.
+    int32_t changeThreshold;
+    bool hasLastValues;
+    TopicValues lastValues;
+    int64_t nextKeyframeMicros;
+};
+
+// Longer lines are a protocol violation and close the connection
+static const size_t MAX_COMMAND_LINE_LENGTH = 64 * 1024;
+static const size_t MAX_TRANSACTION_COMMANDS = 256;
+
+// Clients that do not even read the replies to their own commands are
+// disconnected once this many times the queue limit is pending
+static const size_t REPLY_QUEUE_LIMIT_FACTOR = 4;
+// Lower limits could not hold a reply as long as the longest command line
+static const size_t MIN_CLIENT_QUEUE_LIMIT = MAX_COMMAND_LINE_LENGTH / REPLY_QUEUE_LIMIT_FACTOR;
+
+struct OutgoingMessage {
+    std::string data;
+    // Telemetry may be dropped for slow clients, replies never are
+    bool droppable;
+    // File descriptor sent along with the message using SCM_RIGHTS, or -1.
+    // Owned by the message until it was sent.
+    int passedFd;
+};
+
+// State of a single client connection. Connections are owned by the
+// ControlSocket and only accessed while holding its mutex.
+class Connection {
 public:
-    bool isAlive() const;
+    const uint64_t id;
+    const int fd;
 
-    void sendMessage(const std::string& msg);
-    void startShutdown();
+    // Received data that does not form a complete line yet. The buffer
+    // only grows, so reading does not allocate in steady state.
+    std::vector<char> inBuffer;
+    size_t inLength;
 
-    ConnectionHandler(sockpp::unix_socket& _socket, PushCommandFunction _pushCommand);
-    ~ConnectionHandler();
+    // Messages that could not be written without blocking yet. The first
+    // frontOffset bytes of the first message were already sent.
+    std::deque<OutgoingMessage> outQueue;
+    size_t queuedBytes;
+    size_t frontOffset;
+    uint64_t droppedMessages;
+    // Telemetry and broadcasts queued for sending
+    uint64_t telemetryBytes;
+
+    // Negotiated with the telemetry command, ASCII by default
+    bool binaryTelemetry;
+    // Connections start without subscriptions
+    TopicSubscription topics[(int) TelemetryTopic::COUNT];
+
+    // Settings received between begin and commit. They are only checked
+    // when received and all applied together on commit.
+    bool inTransaction;
+    bool transactionFailed;
+    std::vector<std::string> stagedCommands;
+
+    bool writeWatched;
+    // Set while the command queue is full. Reading stops until the main
+    // thread made room, complete lines stay in inBuffer.
+    bool readPaused;
+    // Set when the client shut down its sending side. The connection is
+    // closed once its commands ran and their replies were written.
+    bool readClosed;
+    // Lines pushed to the command queue that did not run yet
+    uint64_t queuedCommands;
+    bool failed;
+
+    bool finished() const {
+        return readClosed && (queuedCommands == 0) && outQueue.empty();
+    }
+
+    Connection(uint64_t id, int fd);
+    ~Connection();
 };
 
+// Serves all clients of the control socket from a single event loop
+// thread using epoll and non-blocking sockets. The thread sleeps until a
+// client connects, sends data, becomes writable or hangs up.
 class ControlSocket {
 private:
     std::string socketAddr;
 
-    bool alive;
+    std::atomic<bool> alive;
     std::mutex sharedResourceMutex;
     std::thread mainThread;
 
+    int epollFd;
+    int wakeupFd;
+
     std::shared_ptr<sockpp::unix_acceptor> acceptor;
-    std::vector<ConnectionHandler*> handlerThreads;
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections;
+    uint64_t nextConnectionId;
+
+    // Received command lines, pushed by the event loop thread and run by
+    // the thread that calls processEvents
+    CommandQueue commandQueue;
+    bool commandsPushed;
+    CommandArguments commandArguments;
+
+    CommandRegistry registry;
 
-    std::vector<Command> commands;
+    SlowConsumerPolicy slowConsumerPolicy;
+    size_t clientQueueLimit;
+
+    TelemetryRing* telemetryRing;
+
+    int32_t defaultChangeThreshold;
+    int64_t keyframeIntervalMicros;
 
     void threadMain();
+    void acceptConnections();
+    void readConnection(Connection& connection);
+    void extractLines(Connection& connection);
+    void resumePausedConnections();
+    void writeConnection(Connection& connection);
+    void watchWrites(Connection& connection, bool enable);
+    void updateWatch(Connection& connection);
+    void closeConnection(uint64_t id);
+    void closeFinishedConnections();
+    void queueMessage(Connection& connection, const std::string& msg, bool droppable, int passedFd = -1);
+    // Writes as much of the queued data of all connections as possible
+    void flushConnections();
+    bool makeRoom(Connection& connection, size_t size, bool droppable);
+    // Returns the queued message that replies are appended to
+    std::string& replyBuffer(Connection& connection);
+
+    void runCommand(const QueuedCommand& command);
+
+    void registerCommands();
+    void clientStatistics(CommandReply& reply) const;
+    void setTelemetryMode(Connection& connection, const CommandArguments& parameters, CommandReply& reply);
+    void openTelemetryRing(CommandReply& reply);
+    void stageCommand(Connection& connection, std::string_view line, std::string_view name, CommandReply& reply);
+    void beginTransaction(Connection& connection, CommandReply& reply);
+    void commitTransaction(Connection& connection, CommandReply& reply);
+    void abortTransaction(Connection& connection, CommandReply& reply);
+    void subscribe(Connection& connection, const CommandArguments& parameters, bool enable);
 public:
-    void processEvents(CommandHandleFunction handler);
+    // Runs all received commands through the registry and queues the
+    // replies
+    void processEvents();
+    // Sleeps until commands were received or the timeout passed
+    void waitForCommands(int64_t timeoutMicros);
+
+    // Commands can only be added or removed from the thread that calls
+    // processEvents
+    CommandRegistry& getCommandRegistry() {
+        return registry;
+    }
     void broadcastMessage(const std::string& msg);
+    // Sends one frame of telemetry to every client in the format it
+    // negotiated, limited to the topics it subscribed to that are due at
+    // the given time and changed since they were last sent. Empty topic
+    // messages are not sent.
+    void broadcastTelemetry(
+        const TelemetryTopicMessages& topicMessages, 
+        const TelemetryTopicValues& topicValues,
+        const std::string& binary, 
+        int64_t nowMicros
+    );
+
+    // Subscriptions without a threshold of their own use defaultThreshold.
+    // Every keyframe interval all subscribed topics are sent even if they
+    // did not change, 0 sends every frame.
+    void setTelemetryChangeFilter(int32_t defaultThreshold, int64_t keyframeIntervalMicros);
+
+    // Clients, their telemetry and the command statistics of the registry.
+    // Only for command handlers, which run with the connections locked.
+    void writeMetrics(OpenMetricsWriter& writer) const;
+
+    // Offers the ring to clients through the telemetryring command. The 
+    // ring must outlive all calls to processEvents.
+    void shareTelemetryRing(TelemetryRing* ring);
 
-    ControlSocket(std::string socketAddr);
+    ControlSocket(
+        std::string socketAddr, 
+        SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::DropOldest,
+        size_t clientQueueLimit = DEFAULT_CLIENT_QUEUE_LIMIT
+    );
     ~ControlSocket();
 };
@@ -16,6 +16,8 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 #include "device.hpp"
 
+#include "stringtools.hpp"
+
 std::map<WiimoteButton, std::string> WIIMOTE_BUTTON_NAMES = {
     {WiimoteButton::A, "a"},
     {WiimoteButton::B, "b"},
@@ -58,6 +60,29 @@ std::map<int, WiimoteButton> XWIIMOTE_BUTTON_MAP = {
     {XWII_KEY_RIGHT, WiimoteButton::Right}
 };
 
+bool parseWiimoteButtonSet(const std::string& str, WiimoteButtonSet& buttons) {
+    buttons.reset();
+    if (trim(str).empty()) {
+        return true;
+    }
+    for (const std::string& name : split(str, ',')) {
+        const std::string lowerName = asciiLower(trim(name));
+        bool found = false;
+        for (auto& pair : WIIMOTE_BUTTON_READABLE_NAMES) {
+            if (asciiLower(pair.second) == lowerName) {
+                buttons.set((int) pair.first);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            buttons.reset();
+            return false;
+        }
+    }
+    return true;
+}
+
 std::ostream& operator<<(std::ostream& out, const xwii_event_abs& abs) {
     out << "x:" << abs.x << " y:" << abs.y;
     return out;
@@ -27,12 +27,14 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include <exception>
 #include <filesystem>
 #include <chrono>
+#include <bitset>
 
 #include <csignal>
 
 #include <xwiimote.h>
 
 #include "base.hpp"
+#include "latency.hpp"
 
 std::ostream& operator<<(std::ostream& out, const xwii_event_abs& abs);
 
@@ -48,6 +50,9 @@ enum class WiimoteButton {
     A, B, Plus, Minus, Home, One, Two, Up, Down, Left, Right, COUNT, INVALID
 };
 
+// Pressed state of the wiimote buttons, indexed by WiimoteButton
+typedef std::bitset<(int) WiimoteButton::COUNT> WiimoteButtonSet;
+
 extern std::map<int, WiimoteButton> XWIIMOTE_BUTTON_MAP;
 extern std::map<WiimoteButton, std::string> WIIMOTE_BUTTON_NAMES;
 extern std::map<WiimoteButton, std::string> WIIMOTE_BUTTON_READABLE_NAMES;
@@ -63,7 +68,7 @@ static T rmap(const std::map<T, U>& map, const U& value, const T& notFound) {
 }
 
 struct WiimoteButtonStates {
-    bool pressedButtons[(int) WiimoteButton::COUNT];
+    WiimoteButtonSet pressedButtons;
 
     bool isPressed(WiimoteButton button) const {
         return pressedButtons[(int) button];
@@ -83,21 +88,31 @@ struct WiimoteButtonStates {
     }
 
     bool operator==(const WiimoteButtonStates& other) const {
-        for (int i = 0; i < (int) WiimoteButton::COUNT; i++) {
-            if (pressedButtons[i] != other.pressedButtons[i]) {
-                return false;
-            }
-        }
-        return true;
+        return pressedButtons == other.pressedButtons;
     }
 
     bool operator!=(const WiimoteButtonStates& other) const {
         return !(*this == other);
     }
+};
 
-    WiimoteButtonStates() {
-        std::fill(pressedButtons, pressedButtons + (int) WiimoteButton::COUNT, false);
+// Parses a comma separated list of readable button names, for example
+// "plus,minus". Case is ignored, an empty string is an empty set.
+bool parseWiimoteButtonSet(const std::string& str, WiimoteButtonSet& buttons);
+
+// Fires once when all buttons of the chord are held down together
+struct ButtonChord {
+    WiimoteButtonSet buttons;
+    bool wasPressed;
+
+    bool pressed(const WiimoteButtonSet& pressedButtons) {
+        const bool isPressed = buttons.any() && ((pressedButtons & buttons) == buttons);
+        const bool fired = isPressed && !wasPressed;
+        wasPressed = isPressed;
+        return fired;
     }
+
+    ButtonChord() : wasPressed(false) {}
 };
 
 class Xwiimote {
@@ -119,6 +134,15 @@ public:
     xwii_event_abs irdata[4];
     const unsigned int REQUIRED_INTERFACES;
 
+    // Set by poll() when a new IR report arrived: the kernel timestamp of
+    // the report and the time it was dispatched, both CLOCK_REALTIME
+    // microseconds
+    bool irReportPending;
+    int64_t irReportTime;
+    int64_t irDispatchTime;
+    // IR reports dispatched by the last poll(), only the newest is kept
+    int irReportsReceived;
+
     Xwiimote(std::string _devName) : 
         REQUIRED_INTERFACES(XWII_IFACE_CORE | XWII_IFACE_ACCEL | XWII_IFACE_IR) 
     {
@@ -141,6 +165,10 @@ public:
         irdata[3].x = irdata[3].y = irdata[3].z = 1023;
 
         lastAccelPollTime = std::chrono::steady_clock::now();
+
+        irReportPending = false;
+        irReportTime = irDispatchTime = 0;
+        irReportsReceived = 0;
     }
 
     ~Xwiimote() {
@@ -159,6 +187,7 @@ public:
         int err;
         xwii_event ev;
         bool receivedAccelEvent = false;
+        irReportsReceived = 0;
         while (true) {
             err = xwii_iface_dispatch(dev.ref, &ev, sizeof(ev));
             if (err != 0) {
@@ -169,6 +198,10 @@ public:
                 receivedAccelEvent = true;
             } else if (ev.type == XWII_EVENT_IR) {
                 std::copy(ev.v.abs, ev.v.abs + 4, irdata);
+                irReportPending = true;
+                irReportsReceived++;
+                irReportTime = timevalToMicros(ev.time);
+                irDispatchTime = realtimeMicros();
             } else if (ev.type == XWII_EVENT_KEY) {
                 auto found = XWIIMOTE_BUTTON_MAP.find(ev.v.key.code);
                 if (found != XWIIMOTE_BUTTON_MAP.end()) {
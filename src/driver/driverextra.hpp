@@ -16,7 +16,9 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
-#include "intlinalg.hpp"
+#include <bitset>
+
+#include <linux/input.h>
 
 enum class ButtonNamespace {
     NONE,
@@ -24,30 +26,5 @@ enum class ButtonNamespace {
     VMOUSE
 };
 
-struct NamespacedButtonState {
-    static const NamespacedButtonState NONE;
-
-    ButtonNamespace ns;
-    int buttonId;
-    bool state;
-
-    bool matches(const NamespacedButtonState& other) const {
-        return ns == other.ns && buttonId == other.buttonId;
-    }
-
-    operator bool() const {
-        return ns != ButtonNamespace::NONE;
-    }
-
-    bool operator==(const NamespacedButtonState& other) const {
-        return ns == other.ns && buttonId == other.buttonId && state == other.state;
-    }
-
-    NamespacedButtonState(const NamespacedButtonState& other) = default;
-    NamespacedButtonState(
-        ButtonNamespace ns, int buttonId, bool state
-    ) : ns(ns), buttonId(buttonId), state(state) {}
-    NamespacedButtonState() {
-        *this = NONE;
-    }
-};
+// Pressed state of the virtual device keys, indexed by evdev key code
+typedef std::bitset<KEY_CNT> EvdevKeySet;
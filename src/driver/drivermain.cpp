@@ -38,6 +38,12 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include "settings.hpp"
 #include "driveroptparse.hpp"
 #include "driverextra.hpp"
+#include "latency.hpp"
+#include "telemetry.hpp"
+#include "parameterblock.hpp"
+#include "configwatcher.hpp"
+#include "metrics.hpp"
+#include "flightrecorder.hpp"
 
 #include "filterlayers/base.hpp"
 #include "filterlayers/buttons.hpp"
@@ -47,11 +53,12 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include "filterlayers/clustering.hpp"
 #include "filterlayers/towedcircle.hpp"
 
-
-class WiiMouse {
-private:
-    Xwiimote::Ptr wiimote;
-    VirtualMouse vmouse;
+// Everything a frame reads from the settings, published as one block
+struct WiiMouseParameters {
+    WMPClusteringParameters clustering;
+    WMPButtonMapperParameters buttonMapper;
+    WMPSmootherParameters smoother;
+    WMPTowedCircleParameters towedCircle;
 
     Vector3 calmatX;
     Vector3 calmatY;
@@ -59,8 +66,51 @@ private:
     Vector3f screenAreaTopLeft;
     Vector3f screenAreaBottomRight;
 
-    Vector3 wiimoteMouseMatX;
-    Vector3 wiimoteMouseMatY;
+    // Calibration and screen area folded into one transform from
+    // roll-corrected wiimote coordinates to mouse coordinates. Composed when
+    // the parameters change and applied once per frame at the output, all
+    // filter stages stay in wiimote coordinates.
+    Matrix2x3f wiimoteMouseTransform;
+
+    void computeMouseMat() {
+        const Vector3f screenAreaSize = screenAreaBottomRight - screenAreaTopLeft;
+
+        Vector3f rowX = Vector3f(calmatX) * (screenAreaSize.values[0] / 10000.0f);
+        Vector3f rowY = Vector3f(calmatY) * (screenAreaSize.values[1] / 10000.0f);
+
+        rowX.values[2] += screenAreaTopLeft.values[0];
+        rowY.values[2] += screenAreaTopLeft.values[1];
+
+        wiimoteMouseTransform = Matrix2x3f(rowX, rowY);
+    }
+};
+
+class WiiMouse {
+private:
+    Xwiimote::Ptr wiimote;
+    VirtualMouse vmouse;
+    LatencyProbe& latencyProbe;
+    DriverMetrics& metrics;
+
+    // Setters only change pendingParameters. publishParameters hands them
+    // to process() as a new block, so a frame never sees half of an update.
+    WiiMouseParameters pendingParameters;
+    bool parametersChanged;
+    ParameterBlock<WiiMouseParameters> parameters;
+    // Applied on top of the published parameters, never stored in a
+    // profile
+    bool calibrationMode;
+
+    struct Profile {
+        std::string name;
+        WiiMouseParameters parameters;
+    };
+
+    // Fully computed parameters of every profile. Changes to the active
+    // profile are copied back when they are published.
+    std::vector<Profile> profiles;
+    int activeProfile;
+    ButtonChord profileSwitchChord;
 
     std::chrono::time_point<std::chrono::steady_clock> lastupdate;
 
@@ -75,33 +125,118 @@ private:
 
     std::vector<WiiMouseProcessingModule*> processorSequence;
 
-    void computeMouseMat() {
-        Vector3f screenAreaSize = screenAreaBottomRight - screenAreaTopLeft;
+    // Key states last written to the virtual mouse
+    EvdevKeySet emittedKeys;
 
-        wiimoteMouseMatX = calmatX * Scalar(screenAreaSize.values[0] / 10000L, 1000000);
-        wiimoteMouseMatY = calmatY * Scalar(screenAreaSize.values[1] / 10000L, 1000000);
-
-        wiimoteMouseMatX.values[2] += screenAreaTopLeft.values[0];
-        wiimoteMouseMatY.values[2] += screenAreaTopLeft.values[1];
-
-        wiimoteMouseMatX = wiimoteMouseMatX.redivide(100);
-        wiimoteMouseMatY = wiimoteMouseMatY.redivide(100);
-    }
+    bool cursorValid;
+    int cursorX, cursorY;
 
     void internalSetScreenArea(
         const Scalar& left, const Scalar& top, const Scalar& right, const Scalar& bottom
     ) {
-        screenAreaTopLeft = Vector3f(
+        pendingParameters.screenAreaTopLeft = Vector3f(
             clamp(min(left, right).toFloat(), 0, 10000),
             clamp(min(top, bottom).toFloat(), 0, 10000),
             0L
         );
-        screenAreaBottomRight = Vector3f(
+        pendingParameters.screenAreaBottomRight = Vector3f(
             clamp(max(left, right).toFloat(), 0, 10000),
             clamp(max(top, bottom).toFloat(), 0, 10000),
             0L
         );
-        computeMouseMat();
+        parametersChanged = true;
+    }
+
+    // Everything of a frame that only depends on its input
+    void runFrame(FlightRecord& record) {
+        const FrameInput& input = record.input;
+
+        const WiiMouseParameters& p = parameters.acquire();
+        clustering.setParameters(p.clustering);
+        buttonMapper.setParameters(p.buttonMapper);
+        smoother.setParameters(p.smoother);
+        towedCircle.setParameters(p.towedCircle);
+
+        processingStart.nValidIrSpots = 0;
+        for (int i = 0; i < 4; i++) {
+            xwii_event_abs ir;
+            ir.x = input.ir[i][0];
+            ir.y = input.ir[i][1];
+            ir.z = 0;
+            Vector3f point(ir.x, ir.y, 0);
+            bool valid = xwii_event_ir_is_valid(&ir) && (point.len() > 0);
+
+            if (valid) {
+                processingStart.trackingDots[processingStart.nValidIrSpots] = point;
+                processingStart.nValidIrSpots++;
+            }
+        }
+
+        processingStart.deltaT = input.deltaT;
+        processingStart.accelVector = Vector3f(input.accel[0], input.accel[1], input.accel[2]);
+        processingStart.wiiButtons = WiimoteButtonSet(input.buttons);
+        processingStart.history[ProcessingOutputHistoryPoint::Cluster] = &processingStart;
+        runProcessing();
+
+        // Only key transitions reach the virtual device
+        const EvdevKeySet keys = mouseEnabled ? processingEnd.pressedKeys : EvdevKeySet();
+        const EvdevKeySet changedKeys = keys ^ emittedKeys;
+        if (changedKeys.any()) {
+            for (int code = 0; code < (int) changedKeys.size(); code++) {
+                if (changedKeys[code]) {
+                    vmouse.button(code, keys[code]);
+                }
+            }
+            emittedKeys = keys;
+        }
+        if (mouseEnabled) {
+            if (processingEnd.nValidIrSpots > 0) {
+                Vector3f mid;
+                for (int i = 0; i < processingEnd.nValidIrSpots; i++) {
+                    mid = mid + processingEnd.trackingDots[i];
+                }
+                mid = mid / processingEnd.nValidIrSpots;
+
+                const Vector3f mouseCoord = p.wiimoteMouseTransform.apply(mid);
+                cursorX = (int) clamp(
+                    mouseCoord.values[0],
+                    p.screenAreaTopLeft.values[0],
+                    p.screenAreaBottomRight.values[0]
+                );
+                cursorY = (int) clamp(
+                    mouseCoord.values[1],
+                    p.screenAreaTopLeft.values[1],
+                    p.screenAreaBottomRight.values[1]
+                );
+                cursorValid = true;
+                vmouse.move(cursorX, cursorY);
+            } 
+        }
+
+        record.stageCount = std::min((int) processorSequence.size(), FLIGHT_RECORDER_MAX_STAGES);
+        for (int stage = 0; stage < record.stageCount; stage++) {
+            const WiiMouseProcessingModule& module = *processorSequence[stage];
+            FlightStageOutput& output = record.stages[stage];
+            output.validSpots = module.nValidIrSpots;
+            for (int i = 0; i < 4; i++) {
+                output.dots[i][0] = module.trackingDots[i].values[0];
+                output.dots[i][1] = module.trackingDots[i].values[1];
+            }
+        }
+        record.cursorValid = cursorValid;
+        record.cursor[0] = cursorX;
+        record.cursor[1] = cursorY;
+    }
+
+    void publishPendingParameters() {
+        if (!calibrationMode) {
+            parameters.publish(pendingParameters);
+            return;
+        }
+        WiiMouseParameters calibrating = pendingParameters;
+        calibrating.clustering.enablePointCollapse = false;
+        calibrating.smoother.enabled = false;
+        parameters.publish(calibrating);
     }
 
     void runProcessing() {
@@ -116,26 +251,107 @@ private:
 public:
     bool mouseEnabled;
 
+    // Makes all parameter changes since the last call visible to the next
+    // frame
+    void publishParameters() {
+        if (!parametersChanged) {
+            return;
+        }
+        pendingParameters.computeMouseMat();
+        if ((activeProfile >= 0) && (activeProfile < (int) profiles.size())) {
+            profiles[activeProfile].parameters = pendingParameters;
+        }
+        publishPendingParameters();
+        parametersChanged = false;
+    }
+
+    void clearProfiles() {
+        profiles.clear();
+        activeProfile = -1;
+    }
+
+    // Stores the current parameters as a profile
+    void storeProfile(const std::string& name) {
+        pendingParameters.computeMouseMat();
+        profiles.push_back({name, pendingParameters});
+    }
+
+    // Publishes the stored parameters of a profile as they are, nothing is
+    // recomputed
+    bool switchProfile(const std::string& name) {
+        for (int i = 0; i < (int) profiles.size(); i++) {
+            if (profiles[i].name == name) {
+                activeProfile = i;
+                pendingParameters = profiles[i].parameters;
+                publishPendingParameters();
+                parametersChanged = false;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool hasProfile(const std::string& name) const {
+        for (const Profile& profile : profiles) {
+            if (profile.name == name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const std::string& getActiveProfile() const {
+        static const std::string NO_PROFILE;
+        if ((activeProfile < 0) || (activeProfile >= (int) profiles.size())) {
+            return NO_PROFILE;
+        }
+        return profiles[activeProfile].name;
+    }
+
+    // The profile after the active one, wrapping around
+    const std::string& getNextProfile() const {
+        if (profiles.empty()) {
+            return getActiveProfile();
+        }
+        return profiles[(activeProfile + 1) % profiles.size()].name;
+    }
+
+    void setProfileSwitchChord(const WiimoteButtonSet& buttons) {
+        profileSwitchChord.buttons = buttons;
+    }
+
+    // True once when the profile switch chord was pressed during the last
+    // frame
+    bool profileSwitchChordPressed() {
+        return profileSwitchChord.pressed(wiimote->buttonStates.pressedButtons);
+    }
+
+    std::vector<std::string> getProfiles() const {
+        std::vector<std::string> result;
+        for (const Profile& profile : profiles) {
+            result.push_back(profile.name);
+        }
+        return result;
+    }
+
     void setScreenArea(const Scalar& left, const Scalar& top, const Scalar& right, const Scalar& bottom) {
         internalSetScreenArea(left, top, right, bottom);
-        std::cout << "Screen area set to " << screenAreaTopLeft << " and " << screenAreaBottomRight << std::endl;
     }
 
     void getScreenArea(Vector3f& topLeft, Vector3f& bottomRight) const {
-        topLeft = screenAreaTopLeft;
-        bottomRight = screenAreaBottomRight;
+        topLeft = pendingParameters.screenAreaTopLeft;
+        bottomRight = pendingParameters.screenAreaBottomRight;
     }
 
     void getCalibrationVectors(Vector3& x, Vector3& y) const {
-        x = calmatX;
-        y = calmatY;
+        x = pendingParameters.calmatX;
+        y = pendingParameters.calmatY;
     }
 
     void setCalibrationVectors(const Vector3& x, const Vector3& y) {
-        calmatX = x.redivide(100);
-        calmatY = y.redivide(100);
-        computeMouseMat();
-        std::cout << "Calibration vectors set to " << calmatX << " and " << calmatY << std::endl;
+        pendingParameters.calmatX = x.redivide(100);
+        pendingParameters.calmatY = y.redivide(100);
+        parametersChanged = true;
     }
 
     bool hasValidLeftRight() const {
@@ -151,16 +367,17 @@ public:
     }
 
     float getClusteringDefaultDistance() const {
-        return clustering.irSpotClustering.defaultDistance;
+        return pendingParameters.clustering.defaultDistance;
     }
 
     void setClusteringDefaultDistance(float distance) {
-        clustering.irSpotClustering.defaultDistance = distance;
+        pendingParameters.clustering.defaultDistance = distance;
+        parametersChanged = true;
     }
 
     void setCalibrationMode(bool on) {
-        clustering.enablePointCollapse = !on;
-        smoother.enabled = !on;
+        calibrationMode = on;
+        parametersChanged = true;
     }
 
     void getSmoothingFactors(
@@ -168,9 +385,9 @@ public:
         float& smoothingReleased,
         float& clickFreeze
     ) const {
-        smoothingClicked = smoother.positionMixFactorClicked;
-        smoothingReleased = smoother.positionMixFactor;
-        clickFreeze = smoother.clickReleaseFreezeDelay;
+        smoothingClicked = pendingParameters.smoother.positionMixFactorClicked;
+        smoothingReleased = pendingParameters.smoother.positionMixFactor;
+        clickFreeze = pendingParameters.smoother.clickReleaseFreezeDelay;
     }
 
     void setSmoothingFactors(
@@ -178,9 +395,10 @@ public:
         float smoothingReleased,
         float clickFreeze
     ) {
-        smoother.positionMixFactorClicked = smoothingClicked;
-        smoother.positionMixFactor = smoothingReleased;
-        smoother.clickReleaseFreezeDelay = clickFreeze;
+        pendingParameters.smoother.positionMixFactorClicked = smoothingClicked;
+        pendingParameters.smoother.positionMixFactor = smoothingReleased;
+        pendingParameters.smoother.clickReleaseFreezeDelay = clickFreeze;
+        parametersChanged = true;
     }
 
     void getFilteredLrPoints(Vector3f& l, Vector3f& r) const {
@@ -202,19 +420,21 @@ public:
     }
 
     std::map<WiimoteButtonMappingState, std::string> getButtonMap() const {
-        return buttonMapper.getStringMappings();
+        return pendingParameters.buttonMapper.getStringMappings();
     }
 
     void clearButtonMap() {
-        buttonMapper.clearMapping();
+        pendingParameters.buttonMapper.clearMapping();
+        parametersChanged = true;
     }
 
     void mapButton(WiimoteButton button, bool ir, const SupportedButton* evdevButton) {
         if (!evdevButton) {
-            buttonMapper.clearButtonAssignments(button, ir);
+            pendingParameters.buttonMapper.clearButtonAssignments(button, ir);
         } else {
-            buttonMapper.addMapping(button, ir, evdevButton->code);
+            pendingParameters.buttonMapper.addMapping(button, ir, evdevButton->code);
         }
+        parametersChanged = true;
     }
 
     const WiimoteButtonStates& getButtonStates() const {
@@ -229,106 +449,116 @@ public:
     }
 
     float getToweredCircleRadius() const {
-        return towedCircle.radius;
+        return pendingParameters.towedCircle.radius;
     }
 
     void setToweredCircleRadius(float radius) {
-        towedCircle.radius = radius;
+        pendingParameters.towedCircle.radius = radius;
+        parametersChanged = true;
     }
 
-    void process() {
+    // Reads the wiimote and runs one frame through the pipeline. The input
+    // and what every stage made of it end up in record.
+    void process(FlightRecord& record) {
         std::chrono::time_point<std::chrono::steady_clock> now = 
             std::chrono::steady_clock::now();
 
         wiimote->poll();
 
-        Vector3 accelVector = Vector3(wiimote->accelX, wiimote->accelY, wiimote->accelZ);
-
-        {
-            processingStart.nValidIrSpots = 0;
-            for (int i = 0; i < 4; i++) {
-                Vector3f point(
-                    wiimote->irdata[i].x, wiimote->irdata[i].y, 0
-                );
-                bool valid = xwii_event_ir_is_valid(
-                    &(wiimote->irdata[i])
-                ) && (point.len() > 0);
-
-                if (valid) {
-                    processingStart.trackingDots[processingStart.nValidIrSpots] = point;
-                    processingStart.nValidIrSpots++;
-                }
-            }
-        }
-
-        processingStart.deltaT = std::chrono::duration_cast<std::chrono::milliseconds>(
+        FrameInput& input = record.input;
+        input.time = realtimeMicros();
+        input.deltaT = (int32_t) std::chrono::duration_cast<std::chrono::milliseconds>(
             now - lastupdate
         ).count();
-        processingStart.accelVector = accelVector;
-        {
-            for (int bi = 0; bi < (int) WiimoteButton::COUNT; bi++) {
-                processingStart.pressedButtons[bi] = NamespacedButtonState(
-                    ButtonNamespace::WII, bi, wiimote->buttonStates.pressedButtons[bi]
-                );
-            }
+        input.irReports = wiimote->irReportsReceived;
+        for (int i = 0; i < 4; i++) {
+            input.ir[i][0] = wiimote->irdata[i].x;
+            input.ir[i][1] = wiimote->irdata[i].y;
         }
-        processingStart.history[ProcessingOutputHistoryPoint::Cluster] = &processingStart;
-        runProcessing();
-
-        for (auto button : processingEnd.pressedButtons) {
-            if (!button) {
-                break;
-            }
-            if (button.ns == ButtonNamespace::VMOUSE) {
-                vmouse.button(button.buttonId, button.state && mouseEnabled);
-            }
+        input.accel[0] = wiimote->accelX;
+        input.accel[1] = wiimote->accelY;
+        input.accel[2] = wiimote->accelZ;
+        input.buttons = (uint32_t) wiimote->buttonStates.pressedButtons.to_ulong();
+
+        const bool irReportPending = wiimote->irReportPending;
+        wiimote->irReportPending = false;
+
+        const uint64_t writtenEvents = vmouse.writtenEvents;
+        runFrame(record);
+
+        const int64_t outputStartTime = realtimeMicros();
+        if (vmouse.flush() && irReportPending) {
+            latencyProbe.record(
+                wiimote->irReportTime,
+                wiimote->irDispatchTime,
+                outputStartTime,
+                realtimeMicros()
+            );
         }
-        if (mouseEnabled) {
-            if (processingEnd.nValidIrSpots > 0) {
-                Vector3f mid;
-                for (int i = 0; i < processingEnd.nValidIrSpots; i++) {
-                    mid = mid + processingEnd.trackingDots[i];
-                }
-                mid = mid / processingEnd.nValidIrSpots;
-                mid.values[2] = 1.0f;
-
-                const Vector3 mouseCoord = Vector3(
-                    clamp(
-                        mid.dot(wiimoteMouseMatX),
-                        screenAreaTopLeft.values[0],
-                        screenAreaBottomRight.values[0]
-                    ),
-                    clamp(
-                        mid.dot(wiimoteMouseMatY),
-                        screenAreaTopLeft.values[1],
-                        screenAreaBottomRight.values[1]
-                    ),
-                    0L
-                );
 
-                vmouse.move(
-                    mouseCoord.values[0].value,
-                    mouseCoord.values[1].value
-                );
-            } 
+        metrics.framesProcessed++;
+        metrics.validSpotFrames[processingStart.nValidIrSpots]++;
+        metrics.irReports += input.irReports;
+        if (input.irReports > 1) {
+            metrics.coalescedIrReports += input.irReports - 1;
         }
+        metrics.uinputEvents += vmouse.writtenEvents - writtenEvents;
 
         lastupdate = now;
     }
 
-    WiiMouse(Xwiimote::Ptr wiimote) : wiimote(wiimote), vmouse(10001) {
+    // Runs the input of a recorded frame through the pipeline instead of
+    // reading the wiimote and replaces the recorded output with the new
+    // one. The WiiMouse of a replay has no wiimote.
+    void replay(FlightRecord& record) {
+        runFrame(record);
+        vmouse.flush();
+    }
+
+    // Releases all keys held on the output, for example when the wiimote
+    // disappeared while a button was pressed
+    void releaseKeys() {
+        vmouse.releaseAll();
+        emittedKeys.reset();
+    }
+
+    void getAccel(int& x, int& y, int& z) const {
+        x = wiimote->accelX;
+        y = wiimote->accelY;
+        z = wiimote->accelZ;
+    }
+
+    // Last position the mouse was moved to, in absolute mouse coordinates
+    bool getCursor(int& x, int& y) const {
+        x = cursorX;
+        y = cursorY;
+        return cursorValid;
+    }
+
+    WiiMouse(
+        Xwiimote::Ptr wiimote, 
+        std::shared_ptr<MouseOutputSink> output,
+        LatencyProbe& latencyProbe,
+        DriverMetrics& metrics
+    ) : wiimote(wiimote), vmouse(output), latencyProbe(latencyProbe), metrics(metrics) {
         mouseEnabled = true;
+        cursorValid = false;
+        cursorX = cursorY = 0;
+        parametersChanged = false;
+        calibrationMode = false;
+        activeProfile = -1;
         lastupdate = std::chrono::steady_clock::now();
 
-        calmatX = Vector3(Scalar(-10000, 1024), 0, 10000).redivide(100);
-        calmatY = Vector3(0, Scalar(10000, 1024), 0).redivide(100);
+        pendingParameters.calmatX = Vector3(Scalar(-10000, 1024), 0, 10000).redivide(100);
+        pendingParameters.calmatY = Vector3(0, Scalar(10000, 1024), 0).redivide(100);
 
         internalSetScreenArea(
             0, 0, 10000, 10000
         );
 
-        buttonMapper.addMapping(WiimoteButton::A, true, BTN_LEFT);
-        buttonMapper.addMapping(WiimoteButton::B, true, BTN_RIGHT);
+        pendingParameters.buttonMapper.addMapping(WiimoteButton::A, true, BTN_LEFT);
+        pendingParameters.buttonMapper.addMapping(WiimoteButton::B, true, BTN_RIGHT);
+        publishParameters();
 
         processorSequence.push_back(&processingStart);
         processorSequence.push_back(&clustering);
@@ -341,12 +571,19 @@ public:
     }
 };
 
+static const std::chrono::milliseconds FRAME_INTERVAL(10);
+
 bool interuptMainLoop = false;
+bool flightDumpRequested = false;
 
 void signalHandler(int signum) {
     interuptMainLoop = true;
 }
 
+void flightDumpSignalHandler(int signum) {
+    flightDumpRequested = true;
+}
+
 WiimoteButton configButtonNameToWiimote(const std::string& name) {
     static std::map<std::string, WiimoteButton> LOWERCASE_READABLE_NAMES;
     if (LOWERCASE_READABLE_NAMES.size() == 0) {
@@ -384,112 +621,740 @@ Vector3 getConfSmootingVector(WiiMouse& wmouse) {
     ).redivide(100000);
 }
 
-void applyDeviceConfigurations(WiiMouse& wmouse, Config& config) {
-    static bool AppliedDefaults = false;
-    if (!AppliedDefaults) {
-        Vector3 defX, defY;
-        wmouse.getCalibrationVectors(defX, defY);
-        config.provideDefault("calmatx", vector3ToString(defX));
-        config.provideDefault("calmaty", vector3ToString(defY));
-        config.provideDefault(
-            "screen_top_left",
-            vector3ToString(Vector3(0, 0, 0))
-        );
-        config.provideDefault(
-            "screen_bottom_right",
-            vector3ToString(Vector3(10000, 10000, 0))
-        );
-        auto keyMappings = wmouse.getButtonMap();
-        for (auto& mapping : keyMappings) {
-            config.provideDefault(
-                mapping.first.toConfigurationKey(),
-                mapping.second
-            );
-        }
-        config.provideDefault(
-            "default_ir_distance",
-            std::to_string((int64_t) (wmouse.getClusteringDefaultDistance() * 100))
-        );
-
-        config.provideDefault(
-            "smoothing_clicked_released_delay",
-            vector3ToString(getConfSmootingVector(wmouse))
-        );
-
-        config.provideDefault(
-            "towed_circle_radius",
-            std::to_string((int64_t) (wmouse.getToweredCircleRadius() * 10000))
-        );
-        AppliedDefaults = true;
-    }
-
+void applyCalibrationConfiguration(WiiMouse& wmouse, const Settings& settings) {
     wmouse.setCalibrationVectors(
-        config.vectorOptions["calmatx"],
-        config.vectorOptions["calmaty"]
+        settings.vector(SettingKey::CalmatX),
+        settings.vector(SettingKey::CalmatY)
     );
+}
+
+void applyScreenAreaConfiguration(WiiMouse& wmouse, const Settings& settings) {
+    const Vector3& topLeft = settings.vector(SettingKey::ScreenTopLeft);
+    const Vector3& bottomRight = settings.vector(SettingKey::ScreenBottomRight);
     wmouse.setScreenArea(
-        config.vectorOptions["screen_top_left"].values[0],
-        config.vectorOptions["screen_top_left"].values[1],
-        config.vectorOptions["screen_bottom_right"].values[0],
-        config.vectorOptions["screen_bottom_right"].values[1]
+        topLeft.values[0],
+        topLeft.values[1],
+        bottomRight.values[0],
+        bottomRight.values[1]
     );
+}
 
-    Vector3f smoothingVector = config.vectorOptions["smoothing_clicked_released_delay"];
+void applySmoothingConfiguration(WiiMouse& wmouse, const Settings& settings) {
+    Vector3f smoothingVector = settings.vector(SettingKey::SmoothingClickedReleasedDelay);
     wmouse.setSmoothingFactors(
         pow(10, smoothingVector.values[0]),
         pow(10, smoothingVector.values[1]),
         smoothingVector.values[2]
     );
+}
 
-    try {
-        wmouse.setToweredCircleRadius(
-            clamp(std::stoll(config.stringOptions["towed_circle_radius"]), 0L, 10000L) / 10000.0f
-        );
+void applyTowedCircleConfiguration(WiiMouse& wmouse, const Settings& settings) {
+    wmouse.setToweredCircleRadius(settings.integer(SettingKey::TowedCircleRadius) / 10000.0f);
+}
+
+void applyIrDistanceConfiguration(WiiMouse& wmouse, const Settings& settings) {
+    wmouse.setClusteringDefaultDistance(settings.integer(SettingKey::DefaultIrDistance) / 100.0f);
+}
+
+void applyButtonConfiguration(WiiMouse& wmouse, const Settings& settings) {
+    wmouse.clearButtonMap();
+    for (int button = 0; button < (int) WiimoteButton::COUNT; button++) {
+        for (bool ir : {true, false}) {
+            const int64_t index = settings.integer(buttonSettingKey((WiimoteButton) button, ir));
+            wmouse.mapButton(
+                (WiimoteButton) button, 
+                ir, 
+                index < 0 ? nullptr : &SUPPORTED_BUTTONS[index]
+            );
+        }
+    }
+}
+
+void applyDeviceConfigurations(WiiMouse& wmouse, const Settings& settings) {
+    applyCalibrationConfiguration(wmouse, settings);
+    applyScreenAreaConfiguration(wmouse, settings);
+    applySmoothingConfiguration(wmouse, settings);
+    applyTowedCircleConfiguration(wmouse, settings);
+    applyIrDistanceConfiguration(wmouse, settings);
+    applyButtonConfiguration(wmouse, settings);
+}
+
+// Only re-applies the subsystems whose options are in changedKeys. Filter
+// state is kept, new parameters take effect with the next frame.
+void applyChangedConfigurations(
+    WiiMouse& wmouse, const Settings& settings, const SettingKeySet& changedKeys
+) {
+    auto changed = [&changedKeys](SettingKey key) {
+        return changedKeys.test((size_t) key);
+    };
+
+    if (changed(SettingKey::CalmatX) || changed(SettingKey::CalmatY)) {
+        applyCalibrationConfiguration(wmouse, settings);
     }
-    catch (std::exception& e) {
-        std::cerr << "Invalid option for towed_circle_radius" << std::endl;
+    if (changed(SettingKey::ScreenTopLeft) || changed(SettingKey::ScreenBottomRight)) {
+        applyScreenAreaConfiguration(wmouse, settings);
+    }
+    if (changed(SettingKey::SmoothingClickedReleasedDelay)) {
+        applySmoothingConfiguration(wmouse, settings);
+    }
+    if (changed(SettingKey::TowedCircleRadius)) {
+        applyTowedCircleConfiguration(wmouse, settings);
+    }
+    if (changed(SettingKey::DefaultIrDistance)) {
+        applyIrDistanceConfiguration(wmouse, settings);
+    }
+    for (int key = (int) SettingKey::ButtonA; key <= (int) SettingKey::ButtonRightOffscreen; key++) {
+        if (changedKeys.test(key)) {
+            applyButtonConfiguration(wmouse, settings);
+            break;
+        }
     }
+}
 
-    try {
-        int64_t defaultIrDistance = std::stoll(config.stringOptions["default_ir_distance"]);
-        wmouse.setClusteringDefaultDistance(defaultIrDistance / 100.0f);
+bool switchProfile(WiiMouse& wmouse, Config& config, const std::string& name) {
+    if (!wmouse.switchProfile(name)) {
+        return false;
     }
-    catch (std::exception& e) {
-        std::cerr << "Invalid option for default_ir_distance" << std::endl;
+    config.activeProfile = name;
+    std::cout << "Switched to profile " << name << std::endl;
+    return true;
+}
+
+// Computes the parameters of all profiles up front, so that switching
+// between them only publishes a stored block. Stays quiet unless the
+// active profile is gone.
+void loadProfiles(WiiMouse& wmouse, Config& config) {
+    wmouse.clearProfiles();
+    applyDeviceConfigurations(wmouse, config.settings);
+    wmouse.storeProfile(DEFAULT_PROFILE_NAME);
+    for (const SettingsProfile& profile : config.profiles) {
+        applyDeviceConfigurations(wmouse, profile.settings);
+        wmouse.storeProfile(profile.name);
     }
 
-    wmouse.clearButtonMap();
-    static const std::vector<std::string> ONOFFSCREEN_SUFFIXES = {
-        "",
-        "_offscreen"
+    WiimoteButtonSet chord;
+    parseWiimoteButtonSet(config.settings.text(SettingKey::ProfileSwitchChord), chord);
+    wmouse.setProfileSwitchChord(chord);
+
+    if (!wmouse.switchProfile(config.activeProfile)) {
+        switchProfile(wmouse, config, DEFAULT_PROFILE_NAME);
+    }
+}
+
+// Reply fields shared by the single setting getters and getall
+
+static void writeScreenArea100(CommandReply& reply, WiiMouse& wmouse) {
+    Vector3f topLeftF, bottomRightF;
+    wmouse.getScreenArea(topLeftF, bottomRightF);
+
+    const Vector3 topLeft = topLeftF.toVector3(100);
+    const Vector3 bottomRight = bottomRightF.toVector3(100);
+    reply.field(topLeft.values[0].value)
+        .field(topLeft.values[1].value)
+        .field(bottomRight.values[0].value)
+        .field(bottomRight.values[1].value);
+}
+
+static void writeSmoothing100(CommandReply& reply, WiiMouse& wmouse) {
+    const Vector3 sVec = getConfSmootingVector(wmouse);
+    reply.field(sVec.values[0].redivide(100).value)
+        .field(sVec.values[1].redivide(100).value)
+        .field(sVec.values[2].redivide(100000).value);
+}
+
+static void writeKeymap(CommandReply& reply, WiiMouse& wmouse) {
+    for (auto& mapping : wmouse.getButtonMap()) {
+        reply.field(mapping.first.toProtocolString()).field(mapping.second);
+    }
+}
+
+static void writeKey(CommandReply& reply, const SupportedButton& key) {
+    reply.field(key.rawKeyName)
+        .field(key.name ? key.name : "")
+        .field(key.category);
+}
+
+static const std::string WIIMOTE_COMMANDS = "wiimote";
+static const std::string DRIVER_COMMANDS = "driver";
+static const std::string NO_WIIMOTE_ERROR = "No wiimote connected";
+
+typedef std::function<void(
+    WiiMouse& wmouse, const CommandArguments& arguments, CommandReply& reply
+)> WiiMouseCommandHandler;
+
+// Commands acting on the connected wiimote. They are registered once and
+// reply an error while connectedMouse is null, so pipelined commands are
+// never held back until a wiimote connects.
+void registerWiiMouseCommands(CommandRegistry& registry, WiiMouse* const& connectedMouse, Config& config) {
+    const ParameterType INT = ParameterType::Integer;
+    const ParameterType STRING = ParameterType::String;
+
+    // Also used for validators, without one only the connection is checked
+    auto whileConnected = [&connectedMouse](WiiMouseCommandHandler handler) -> CommandHandler {
+        return [&connectedMouse, handler](const CommandArguments& arguments, CommandReply& reply) {
+            if (!connectedMouse) {
+                reply.error(NO_WIIMOTE_ERROR);
+                return;
+            }
+            if (handler) {
+                handler(*connectedMouse, arguments, reply);
+            }
+        };
     };
-    for (auto btnName : WIIMOTE_BUTTON_READABLE_NAMES) {
-        for (auto suffix : ONOFFSCREEN_SUFFIXES) {
-            std::string wiiConfName = asciiLower("button_" + btnName.second + suffix);
-            auto foundConf = config.stringOptions.find(wiiConfName);
-            if (foundConf == config.stringOptions.end()) {
-                continue;
+
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "mouse", 
+        "Enables or disables mouse output",
+        {{"state", STRING, "on|off", false}},
+        whileConnected(nullptr),
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            wmouse.mouseEnabled = parameters[0] == "on";
+        })
+    );
+    registry.add(
+        WIIMOTE_COMMANDS, "profiles", 
+        "Returns the active profile followed by the number and names of all profiles",
+        {},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            const std::vector<std::string> profiles = wmouse.getProfiles();
+            reply.ok().field(wmouse.getActiveProfile()).field((int64_t) profiles.size());
+            for (const std::string& name : profiles) {
+                reply.field(name);
             }
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "profile", 
+        "Switches to a profile. The switch is not written to the config file.",
+        {{"name", STRING, "", false}},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            if (!wmouse.hasProfile(std::string(parameters[0]))) {
+                reply.error("Unknown profile");
+            }
+        }),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            switchProfile(wmouse, config, std::string(parameters[0]));
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "cal100", 
+        "Sets the calibration matrix rows in hundredths",
+        {
+            {"x0", INT, "", false}, {"x1", INT, "", false}, {"x2", INT, "", false},
+            {"y0", INT, "", false}, {"y1", INT, "", false}, {"y2", INT, "", false}
+        },
+        whileConnected(nullptr),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            const Vector3 x(
+                Scalar(parameters.integer(0), 100),
+                Scalar(parameters.integer(1), 100),
+                Scalar(parameters.integer(2), 100)
+            );
+            const Vector3 y(
+                Scalar(parameters.integer(3), 100),
+                Scalar(parameters.integer(4), 100),
+                Scalar(parameters.integer(5), 100)
+            );
+            wmouse.setCalibrationVectors(x, y);
+            Vector3 calmatX, calmatY;
+            wmouse.getCalibrationVectors(calmatX, calmatY);
+            std::cout << "Calibration vectors set to " << calmatX << " and " << calmatY << std::endl;
+            config.setVector(SettingKey::CalmatX, x);
+            config.setVector(SettingKey::CalmatY, y);
+            config.markChanged();
+        })
+    );
+    registry.add(
+        WIIMOTE_COMMANDS, "getscreenarea100", 
+        "Returns the screen area as left, top, right, bottom in hundredths of a percent",
+        {},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            writeScreenArea100(reply.ok(), wmouse);
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "screenarea100", 
+        "Sets the screen area in hundredths of a percent",
+        {
+            {"left", INT, "", false}, {"top", INT, "", false}, 
+            {"right", INT, "", false}, {"bottom", INT, "", false}
+        },
+        whileConnected(nullptr),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            wmouse.setScreenArea(
+                Scalar(parameters.integer(0), 100),
+                Scalar(parameters.integer(1), 100),
+                Scalar(parameters.integer(2), 100),
+                Scalar(parameters.integer(3), 100)
+            );
 
-            const bool ir = suffix == ONOFFSCREEN_SUFFIXES[0];
+            Vector3f topLeftF, bottomRightF;
+            wmouse.getScreenArea(topLeftF, bottomRightF);
+            std::cout << "Screen area set to " << topLeftF << " and " << bottomRightF << std::endl;
+            config.setVector(SettingKey::ScreenTopLeft, topLeftF.toVector3(1000));
+            config.setVector(SettingKey::ScreenBottomRight, bottomRightF.toVector3(1000));
+            config.markChanged();
+        })
+    );
+    registry.add(
+        WIIMOTE_COMMANDS, "keymapget", 
+        "Returns all button bindings as pairs of wiimote button and key",
+        {},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            writeKeymap(reply.ok(), wmouse);
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "bindkey", 
+        "Binds a key to a wiimote button while pointing at the screen (ir=1) or not (ir=0)",
+        {
+            {"button", STRING, "", false}, 
+            {"ir", STRING, "0|1", false}, 
+            {"key", STRING, "", false}
+        },
+        whileConnected([](WiiMouse&, const CommandArguments& parameters, CommandReply& reply) {
+            if (configButtonNameToWiimote(std::string(parameters[0])) == WiimoteButton::INVALID) {
+                reply.error("Invalid wii button");
+                return;
+            }
+            const std::string keyName(trimView(parameters[2]));
+            if ((!findButtonByName(keyName)) && (keyName != "")) {
+                reply.error("Invalid key binding");
+            }
+        }),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            const WiimoteButton wiiButton = configButtonNameToWiimote(
+                std::string(parameters[0])
+            );
+            const bool ir = parameters[1] == "1";
+            const std::string keyName(trimView(parameters[2]));
+
+            wmouse.mapButton(wiiButton, ir, findButtonByName(keyName));
 
-            const std::string& keyName = foundConf->second;
-            const SupportedButton* btn = findButtonByName(keyName);
-            if ((!btn) && (keyName != "")) {
-                std::cerr 
-                    << "Ignoring invalid mapped button: " 
-                    << keyName << std::endl;
-                continue;
+            std::string error;
+            config.parseSetting(buttonSettingKey(wiiButton, ir), keyName, error);
+            config.markChanged();
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "irdist100", 
+        "Sets the default distance between the sensor bar lights in hundredths",
+        {{"distance", INT, "", false}},
+        whileConnected([](WiiMouse&, const CommandArguments& parameters, CommandReply& reply) {
+            if ((parameters.integer(0) < 0) || (parameters.integer(0) > INT32_MAX)) {
+                reply.error("Invalid parameter");
             }
+        }),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            const long long distance = parameters.integer(0);
+            wmouse.setClusteringDefaultDistance(distance / 100.0f);
+            config.setInteger(SettingKey::DefaultIrDistance, distance);
+            config.markChanged();
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "calibration", 
+        "Enables or disables calibration mode",
+        {{"state", STRING, "on|off", false}},
+        whileConnected(nullptr),
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            wmouse.setCalibrationMode(parameters[0] == "on");
+        })
+    );
+    registry.add(
+        WIIMOTE_COMMANDS, "getsmoothing100", 
+        "Returns the log10 smoothing factors while clicked and released in hundredths and the click freeze time",
+        {},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            writeSmoothing100(reply.ok(), wmouse);
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "setsmoothing100", 
+        "Sets the log10 smoothing factors while clicked and released in hundredths and the click freeze time",
+        {
+            {"clicked", INT, "", false}, 
+            {"released", INT, "", false}, 
+            {"freeze", INT, "", false}
+        },
+        whileConnected([](WiiMouse&, const CommandArguments& parameters, CommandReply& reply) {
+            if (parameters.integer(2) < 0) {
+                reply.error("Click freeze negative");
+                return;
+            }
+            if ((parameters.integer(0) > 0) || (parameters.integer(1) > 0)) {
+                reply.error("Log smoothing factors larger than 0");
+            }
+        }),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            const Scalar smoothingClicked(parameters.integer(0), 100);
+            const Scalar smoothingReleased(parameters.integer(1), 100);
+            const Scalar clickFreeze(parameters.integer(2), 100000);
+
+            wmouse.setSmoothingFactors(
+                pow(10.0f, smoothingClicked.toFloat()),
+                pow(10.0f, smoothingReleased.toFloat()),
+                clickFreeze.toFloat()
+            );
+            config.setVector(
+                SettingKey::SmoothingClickedReleasedDelay,
+                Vector3(smoothingClicked, smoothingReleased, clickFreeze).redivide(100000)
+            );
+            config.markChanged();
+        })
+    );
+    registry.add(
+        WIIMOTE_COMMANDS, "gettcradius10000", 
+        "Returns the towed circle radius in ten-thousandths",
+        {},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            reply.ok().field((int64_t) (wmouse.getToweredCircleRadius() * 10000));
+        })
+    );
+    registry.add(
+        WIIMOTE_COMMANDS, "getall", 
+        "Returns all settings as sections of name, value count and values",
+        {},
+        whileConnected([](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            reply.ok();
+
+            reply.field("mouse").field(1).field(wmouse.mouseEnabled ? "on" : "off");
+
+            Vector3 calX, calY;
+            wmouse.getCalibrationVectors(calX, calY);
+            calX = calX.redivide(100);
+            calY = calY.redivide(100);
+            reply.field("cal100").field(6);
+            for (const Vector3* row : {&calX, &calY}) {
+                for (int i = 0; i < 3; i++) {
+                    reply.field(row->values[i].value);
+                }
+            }
+
+            reply.field("screenarea100").field(4);
+            writeScreenArea100(reply, wmouse);
+
+            reply.field("irdist100").field(1)
+                .field((int64_t) (wmouse.getClusteringDefaultDistance() * 100));
+
+            reply.field("smoothing100").field(3);
+            writeSmoothing100(reply, wmouse);
+
+            reply.field("tcradius10000").field(1)
+                .field((int64_t) (wmouse.getToweredCircleRadius() * 10000));
+
+            reply.field("keymap").field(3 * (int64_t) wmouse.getButtonMap().size());
+            writeKeymap(reply, wmouse);
+
+            reply.field("profile").field(1).field(wmouse.getActiveProfile());
+        })
+    );
+    registry.addSetting(
+        WIIMOTE_COMMANDS, "settcradius10000", 
+        "Sets the towed circle radius in ten-thousandths",
+        {{"radius", INT, "", false}},
+        whileConnected([](WiiMouse&, const CommandArguments& parameters, CommandReply& reply) {
+            if (parameters.integer(0) < 0) {
+                reply.error("Invalid parameter");
+            }
+        }),
+        whileConnected([&config](WiiMouse& wmouse, const CommandArguments& parameters, CommandReply& reply) {
+            long long radius = parameters.integer(0);
+            if (radius > 10000) {
+                radius = 10000;
+            }
+            wmouse.setToweredCircleRadius(radius / 10000.0f);
+            config.setInteger(SettingKey::TowedCircleRadius, radius);
+            config.markChanged();
+        })
+    );
+}
+
+// Commands that do not need a wiimote
+void registerDriverCommands(CommandRegistry& registry, LatencyProbe& latencyProbe) {
+    registry.add(
+        DRIVER_COMMANDS, "keycount", 
+        "Returns the number of keys that can be bound",
+        {},
+        [](const CommandArguments& parameters, CommandReply& reply) {
+            reply.ok().field((int64_t) SUPPORTED_BUTTONS.size());
+        }
+    );
+    registry.add(
+        DRIVER_COMMANDS, "keyget", 
+        "Returns the name, readable name and category of a bindable key",
+        {{"index", ParameterType::Integer, "", false}},
+        [](const CommandArguments& parameters, CommandReply& reply) {
+            const long long index = parameters.integer(0);
+            if ((index < 0) || (index >= (int64_t) SUPPORTED_BUTTONS.size())) {
+                reply.error("Out of bounds");
+                return;
+            }
+
+            writeKey(reply.ok(), SUPPORTED_BUTTONS[index]);
+        }
+    );
+    registry.add(
+        DRIVER_COMMANDS, "keylist", 
+        "Returns the number of bindable keys followed by the name, readable name and category of each",
+        {},
+        [](const CommandArguments& parameters, CommandReply& reply) {
+            reply.ok().field((int64_t) SUPPORTED_BUTTONS.size());
+            for (const SupportedButton& key : SUPPORTED_BUTTONS) {
+                writeKey(reply, key);
+            }
+        }
+    );
+    registry.add(
+        DRIVER_COMMANDS, "latency", 
+        "Returns the IR report to output latency statistics in microseconds",
+        {{"action", ParameterType::String, "reset", true}},
+        [&latencyProbe](const CommandArguments& parameters, CommandReply& reply) {
+            reply.ok().field(latencyProbe.toProtocolString());
+            if (parameters.size() == 1) {
+                latencyProbe.reset();
+            }
+        }
+    );
+}
 
-            wmouse.mapButton(btnName.first, ir, btn);
+void registerMetricsCommand(ControlSocket& csocket, const DriverMetrics& metrics, const Config& config) {
+    csocket.getCommandRegistry().add(
+        DRIVER_COMMANDS, "metrics", 
+        "Returns the counters of the driver as OpenMetrics text",
+        {},
+        [&csocket, &metrics, &config](const CommandArguments& parameters, CommandReply& reply) {
+            std::string text;
+            OpenMetricsWriter writer(text);
+            metrics.write(writer);
+
+            writer.family("config_writes", "counter", "Writes of the config file");
+            writer.sample("config_writes", "_total", "", config.getWriteCount());
+            writer.family("config_write_failures", "counter", "Writes of the config file that failed");
+            writer.sample("config_write_failures", "_total", "", config.getFailedWriteCount());
+
+            csocket.writeMetrics(writer);
+            writer.finish();
+            reply.ok().block(text);
         }
+    );
+}
+
+// Writes the flight recorder to a new file in the configured directory.
+// Returns the name of the file.
+bool dumpFlightRecorder(
+    const FlightRecorder& recorder, 
+    const Config& config, 
+    const std::string& reason, 
+    std::string& fileName, 
+    std::string& error
+) {
+    fileName = "flight-" + std::to_string(realtimeMicros()) + "-" + reason + ".dump";
+    const std::string path = config.settings.text(SettingKey::FlightRecorderDirectory) + "/" + fileName;
+    if (!recorder.dump(path, reason, config.activeProfile, error)) {
+        return false;
     }
+    std::cout << "Flight recorder dumped (" << reason << "): " << path << std::endl;
+    return true;
+}
 
+// Returns true if a dump was written
+bool dumpFlightRecorderOnAnomaly(FlightRecorder& recorder, const Config& config, const std::string& reason) {
+    if (!recorder.allowAnomalyDump()) {
+        return false;
+    }
+    std::string fileName, error;
+    if (!dumpFlightRecorder(recorder, config, reason, fileName, error)) {
+        std::cerr << "Failed to dump flight recorder: " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Dumps requested with SIGUSR1
+bool serveFlightDumpSignal(const FlightRecorder& recorder, const Config& config) {
+    if (!flightDumpRequested) {
+        return false;
+    }
+    flightDumpRequested = false;
+    std::string fileName, error;
+    if (!dumpFlightRecorder(recorder, config, "signal", fileName, error)) {
+        std::cerr << "Failed to dump flight recorder: " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void registerFlightRecorderCommands(CommandRegistry& registry, const FlightRecorder& recorder, const Config& config) {
+    registry.add(
+        DRIVER_COMMANDS, "flightdump", 
+        "Writes the frames kept by the flight recorder to a new file and returns its name",
+        {},
+        [&recorder, &config](const CommandArguments& parameters, CommandReply& reply) {
+            std::string fileName, error;
+            if (!dumpFlightRecorder(recorder, config, "command", fileName, error)) {
+                reply.error(error);
+                return;
+            }
+            reply.ok().field(fileName);
+        }
+    );
+}
+
+// Runs the frames of a flight recorder dump through the pipeline with
+// the settings of the config file and prints how the cursor positions
+// compare to the recorded ones
+int replayFlightDump(const std::string& path, Config& config, std::shared_ptr<MouseOutputSink> output) {
+    FlightDumpHeader header;
+    std::vector<FlightRecord> records;
+    std::string error;
+    if (!readFlightDump(path, header, records, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::cerr 
+        << "Replaying " << records.size() << " frames, dumped because of " << header.reason 
+        << " in profile " << header.profile << std::endl;
+
+    LatencyProbe latencyProbe;
+    DriverMetrics metrics;
+    WiiMouse wmouse(nullptr, output, latencyProbe, metrics);
+    config.activeProfile = header.profile;
+    loadProfiles(wmouse, config);
+
+    int differences = 0;
+    std::cout << "frame,time,delta_t,ir_reports,valid_spots,recorded_valid,recorded_x,recorded_y,"
+        << "replayed_valid,replayed_x,replayed_y" << std::endl;
+    for (size_t i = 0; i < records.size(); i++) {
+        const FlightRecord& recorded = records[i];
+        FlightRecord replayed = recorded;
+        wmouse.replay(replayed);
+
+        if ((replayed.cursorValid != recorded.cursorValid) 
+            || (replayed.cursor[0] != recorded.cursor[0]) 
+            || (replayed.cursor[1] != recorded.cursor[1])
+        ) {
+            differences++;
+        }
+        std::cout 
+            << i << "," << recorded.input.time << "," << recorded.input.deltaT 
+            << "," << recorded.input.irReports << "," << replayed.stages[0].validSpots
+            << "," << recorded.cursorValid << "," << recorded.cursor[0] << "," << recorded.cursor[1]
+            << "," << replayed.cursorValid << "," << replayed.cursor[0] << "," << replayed.cursor[1]
+            << std::endl;
+    }
+    std::cerr << differences << " of " << records.size() << " cursor positions differ" << std::endl;
+    return 0;
+}
+
+void applyTelemetryConfiguration(ControlSocket& csocket, const Settings& settings) {
+    csocket.setTelemetryChangeFilter(
+        (int32_t) settings.integer(SettingKey::TelemetryChangeThreshold),
+        settings.integer(SettingKey::TelemetryKeyframeInterval) * 1000
+    );
+}
+
+// Takes over changes other programs made to the config file. Only options
+// whose value changed are applied, wmouse may be null while no wiimote is
+// connected. Our own writes of the file change nothing.
+void reloadChangedConfig(ConfigWatcher* watcher, Config& config, ControlSocket& csocket, WiiMouse* wmouse) {
+    if (!watcher || !watcher->pollChanged()) {
+        return;
+    }
+
+    SettingKeySet changedKeys;
+    bool profilesChanged;
+    if (!config.reloadConfigFile(changedKeys, profilesChanged)) {
+        std::cerr << "Failed to reload config file, keeping current settings" << std::endl;
+        return;
+    }
+    if (changedKeys.none() && !profilesChanged) {
+        return;
+    }
+
+    std::cout << "Config file changed:";
+    for (int key = 0; key < (int) SettingKey::COUNT; key++) {
+        if (changedKeys.test(key)) {
+            std::cout << " " << settingName((SettingKey) key);
+        }
+    }
+    if (profilesChanged) {
+        std::cout << " profiles";
+    }
+    std::cout << std::endl;
+
+    if (
+        changedKeys.test((size_t) SettingKey::TelemetryChangeThreshold) || 
+        changedKeys.test((size_t) SettingKey::TelemetryKeyframeInterval)
+    ) {
+        applyTelemetryConfiguration(csocket, config.settings);
+    }
+    for (SettingKey key : {
+        SettingKey::SocketAddress, SettingKey::SlowConsumerPolicy, 
+        SettingKey::ClientQueueLimit, SettingKey::FlightRecorderSeconds
+    }) {
+        if (changedKeys.test((size_t) key)) {
+            std::cerr << settingName(key) << " takes effect after a restart" << std::endl;
+        }
+    }
+    if (!wmouse) {
+        return;
+    }
+    // Named profiles inherit from the default profile, so they are all
+    // computed again. Without profiles only the changed subsystems are.
+    if (
+        profilesChanged || 
+        !config.profiles.empty() || 
+        changedKeys.test((size_t) SettingKey::ProfileSwitchChord)
+    ) {
+        loadProfiles(*wmouse, config);
+    } else {
+        applyChangedConfigurations(*wmouse, config.settings, changedKeys);
+        wmouse->publishParameters();
+    }
+}
+
+// Answers control commands as soon as they arrive until the deadline.
+// Settings changed by a batch of commands are written once and published
+// to the mouse as one parameter block.
+void serveCommandsUntil(
+    ControlSocket& csocket, 
+    Config& config, 
+    ConfigWatcher* configWatcher,
+    WiiMouse& wmouse, 
+    std::chrono::steady_clock::time_point deadline
+) {
+    while (!interuptMainLoop) {
+        const int64_t remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::steady_clock::now()
+        ).count();
+        if (remaining <= 0) {
+            break;
+        }
+        csocket.waitForCommands(remaining);
+        reloadChangedConfig(configWatcher, config, csocket, &wmouse);
+        csocket.processEvents();
+        if (config.takeInheritedChanges()) {
+            loadProfiles(wmouse, config);
+        }
+        wmouse.publishParameters();
+        config.writeIfChanged();
+    }
+}
+
+std::shared_ptr<MouseOutputSink> createMouseOutput(const std::string& output) {
+    if (output == "uinput") {
+        return std::make_shared<UinputOutputSink>(10001);
+    }
+    if (output == "null") {
+        return std::make_shared<NullOutputSink>();
+    }
+    return std::make_shared<RecordingOutputSink>(output);
 }
 
 int main(int argc, char* argv[]) {
     signal(SIGINT, signalHandler);
+    signal(SIGUSR1, flightDumpSignalHandler);
 
     OptionsMap options;
     try {
@@ -517,12 +1382,39 @@ int main(int argc, char* argv[]) {
     Config config(configFilePath);
     config.parseConfigFile();
 
-    config.provideDefault("socket_address", DEFAULT_SOCKET_ADDR);
-    std::string socketAddr = options.defaultString("socket-path", config.stringOptions["socket_address"]);
+    std::string socketAddr = options.defaultString(
+        "socket-path", config.settings.text(SettingKey::SocketAddress)
+    );
+
+    // Replays must not move the real mouse unless asked to
+    std::shared_ptr<MouseOutputSink> mouseOutput;
+    try {
+        mouseOutput = createMouseOutput(
+            options.defaultString("output", options.count("replay") ? "null" : "uinput")
+        );
+    }
+    catch (const VirtualMouseCreationFailed& e) {
+        std::cerr << "Failed to create mouse output: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (options.count("replay")) {
+        return replayFlightDump(options["replay"], config, mouseOutput);
+    }
+
+    // Checked by the schema when parsed
+    SlowConsumerPolicy slowConsumerPolicy;
+    parseSlowConsumerPolicy(config.settings.text(SettingKey::SlowConsumerPolicy), slowConsumerPolicy);
+    const size_t clientQueueLimit = (size_t) config.settings.integer(SettingKey::ClientQueueLimit);
+
+    // Outlives the commands that refer to it
+    WiiMouse* connectedMouse = nullptr;
 
     std::shared_ptr<ControlSocket> socketref;
     try {
-        socketref = std::shared_ptr<ControlSocket>(new ControlSocket(socketAddr));
+        socketref = std::shared_ptr<ControlSocket>(
+            new ControlSocket(socketAddr, slowConsumerPolicy, clientQueueLimit)
+        );
     }
     catch (const SocketFailed& e) {
         std::cerr << "Failed to create socket: " << e.what() << std::endl;
@@ -531,6 +1423,45 @@ int main(int argc, char* argv[]) {
     ControlSocket& csocket = *socketref;
     std::cout << "Socket address: " << socketAddr << std::endl;
 
+    LatencyProbe latencyProbe;
+    DriverMetrics metrics;
+
+    registerDriverCommands(csocket.getCommandRegistry(), latencyProbe);
+    registerMetricsCommand(csocket, metrics, config);
+
+    FlightRecorder flightRecorder(
+        config.settings.integer(SettingKey::FlightRecorderSeconds) * 1000 / FRAME_INTERVAL.count()
+    );
+    registerFlightRecorderCommands(csocket.getCommandRegistry(), flightRecorder, config);
+
+    applyTelemetryConfiguration(csocket, config.settings);
+
+    std::unique_ptr<ConfigWatcher> configWatcher;
+    try {
+        configWatcher = std::unique_ptr<ConfigWatcher>(new ConfigWatcher(configFilePath));
+    }
+    catch (const ConfigWatcherCreationFailed& e) {
+        std::cerr << "Config file changes are not picked up: " << e.what() << std::endl;
+    }
+
+    TelemetryFrame telemetry;
+    TelemetryTopicMessages asciiTelemetry;
+    TelemetryTopicValues telemetryValues;
+    std::string binaryTelemetry;
+
+    std::unique_ptr<TelemetryRing> telemetryRing;
+    try {
+        telemetryRing = std::unique_ptr<TelemetryRing>(
+            new TelemetryRing(DEFAULT_TELEMETRY_RING_SLOTS, TELEMETRY_RECORD_SIZE)
+        );
+        csocket.shareTelemetryRing(telemetryRing.get());
+    }
+    catch (const TelemetryRingCreationFailed& e) {
+        std::cerr << "Shared memory telemetry not available: " << e.what() << std::endl;
+    }
+
+    registerWiiMouseCommands(csocket.getCommandRegistry(), connectedMouse, config);
+
     while (!interuptMainLoop) {
         Xwiimote::Ptr wiimote;
         {
@@ -538,8 +1469,13 @@ int main(int argc, char* argv[]) {
             monitor.poll();
             if (monitor.count() <= 0) {
                 std::cout << "No Wiimote found. Please pair a new Wiimote now." << std::endl;
+                // Driver and socket commands are answered while waiting
+                // for the wiimote, wiimote commands get an error
                 while ((monitor.count() <= 0) && (!interuptMainLoop)) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    csocket.waitForCommands(100000);
+                    csocket.processEvents();
+                    reloadChangedConfig(configWatcher.get(), config, csocket, nullptr);
+                    serveFlightDumpSignal(flightRecorder, config);
                     monitor.poll();
                 }
             }
@@ -549,366 +1485,100 @@ int main(int argc, char* argv[]) {
             wiimote = monitor.get_device(0);
         }
 
-        WiiMouse wmouse(wiimote);
-        applyDeviceConfigurations(wmouse, config);
+        WiiMouse wmouse(wiimote, mouseOutput, latencyProbe, metrics);
+        metrics.wiimoteConnects++;
+        loadProfiles(wmouse, config);
+        connectedMouse = &wmouse;
 
         std::cout << "Wiimote detected. (Re-)starting mouse driver" << std::endl;
 
-        char irMessageBuffer[1024];
-        WiimoteButtonStates buttonStates;
+        std::chrono::steady_clock::time_point nextFrame = std::chrono::steady_clock::now();
         while (!interuptMainLoop) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // Frames do not catch up after a stall
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            const bool overrun = now > nextFrame + FRAME_INTERVAL;
+            if (overrun) {
+                metrics.tickOverruns++;
+            }
+            nextFrame = std::max(nextFrame + FRAME_INTERVAL, now);
+            serveCommandsUntil(csocket, config, configWatcher.get(), wmouse, nextFrame);
+
+            const int64_t processingStartTime = realtimeMicros();
+            FlightRecord& record = flightRecorder.next();
             try {
-                wmouse.process();
+                wmouse.process(record);
             }
             catch (const DevDisappeared& e) {
                 std::cout << "Wiimote disconnected." << std::endl;
+                wmouse.releaseKeys();
+                metrics.wiimoteDisconnects++;
+                dumpFlightRecorderOnAnomaly(flightRecorder, config, "disconnect");
                 break;
             }
-            std::string eventResultBuffer;
-            csocket.processEvents(
-                [&wmouse, &config, &eventResultBuffer](const std::string& command, const std::vector<std::string>& parameters) {
-                    //std::cout << "Command: " << command << std::endl;
-                    //for (const std::string& p : parameters) {
-                    //    std::cout << "Parameter: " << p << std::endl;
-                    //}
-
-                    if (command == "mouse") {
-                        if (parameters.size() == 1) {
-                            if (parameters[0] == "on") {
-                                wmouse.mouseEnabled = true;
-                                return "OK";
-                            } else if (parameters[0] == "off") {
-                                wmouse.mouseEnabled = false;
-                                return "OK";
-                            }
-                            return "ERROR:Invalid parameter";
-                        }
-                    }
-                    if (command == "cal100") {
-                        if (parameters.size() == 6) {
-                            Vector3 x, y;
-                            try {
-                                x = Vector3(
-                                    Scalar(std::stoll(parameters[0]), 100),
-                                    Scalar(std::stoll(parameters[1]), 100),
-                                    Scalar(std::stoll(parameters[2]), 100)
-                                );
-                                y = Vector3(
-                                    Scalar(std::stoll(parameters[3]), 100),
-                                    Scalar(std::stoll(parameters[4]), 100),
-                                    Scalar(std::stoll(parameters[5]), 100)
-                                );
-                            } 
-                            catch (std::invalid_argument& e) {
-                                return "ERROR:Invalid parameter";
-                            }
-                            catch (std::out_of_range& e) {
-                                return "ERROR:Invalid parameter";
-                            }
-                            wmouse.setCalibrationVectors(x, y);
-                            config.vectorOptions["calmatx"] = x;
-                            config.vectorOptions["calmaty"] = y;
-                            config.writeConfigFile();
-                            return "OK";
-                        }
-                    }
-                    if (command == "getscreenarea100") {
-                        Vector3f topLeftF, bottomRightF;
-                        wmouse.getScreenArea(topLeftF, bottomRightF);
-
-                        Vector3 topLeft = topLeftF.toVector3(100);
-                        Vector3 bottomRight = bottomRightF.toVector3(100);
-
-                        std::stringstream ss;
-                        ss << "OK" 
-                            << ":" << topLeft.values[0].value 
-                            << ":" << topLeft.values[1].value 
-                            << ":" << bottomRight.values[0].value
-                            << ":" << bottomRight.values[1].value;
-                        eventResultBuffer = ss.str();
-                        return eventResultBuffer.c_str();
-                    }
-                    if (command == "screenarea100") {
-                        if (parameters.size() == 4) {
-                            Scalar top, left, bottom, right;
-                            try {
-                                left = Scalar(std::stoll(parameters[0]), 100);
-                                top = Scalar(std::stoll(parameters[1]), 100);
-                                right = Scalar(std::stoll(parameters[2]), 100);
-                                bottom = Scalar(std::stoll(parameters[3]), 100);
-                            } 
-                            catch (std::invalid_argument& e) {
-                                return "ERROR:Invalid parameter";
-                            }
-                            catch (std::out_of_range& e) {
-                                return "ERROR:Invalid parameter";
-                            } 
-                            wmouse.setScreenArea(left, top, right, bottom);
-
-                            Vector3f topLeftF, bottomRightF;
-                            wmouse.getScreenArea(topLeftF, bottomRightF);
-                            config.vectorOptions["screen_top_left"] 
-                                = topLeftF.toVector3(1000);
-                            config.vectorOptions["screen_bottom_right"] 
-                                = bottomRightF.toVector3(1000);
-                            config.writeConfigFile();
-                            return "OK";
-                        } else {
-                            return "ERROR:Invalid parameter";
-                        }
-                    }
-                    if (command == "keycount") {
-                        std::stringstream ss;
-                        ss << "OK:" << SUPPORTED_BUTTONS.size();
-                        eventResultBuffer = ss.str();
-                        return eventResultBuffer.c_str();
-                    }
-                    if (command == "keyget") {
-                        if (parameters.size() != 1) {
-                            return "ERROR:Single key index expected";
-                        }
-                        int index;
-                        try {
-                            index = std::stoi(parameters[0]);
-                        }
-                        catch (std::invalid_argument& e) {
-                            return "ERROR:Invalid index";
-                        }
-                        catch (std::out_of_range& e) {
-                            return "ERROR:Invalid index";
-                        }
-
-                        if ((index < 0) || (index >= (int) SUPPORTED_BUTTONS.size())) {
-                            return "ERROR:Out of bounds";
-                        }
-
-                        auto key = SUPPORTED_BUTTONS[index];
-
-                        std::stringstream ss;
-                        ss << "OK:" 
-                            << key.rawKeyName 
-                            << ":" << (key.name ? key.name : "")
-                            << ":" << key.category;
-                        eventResultBuffer = ss.str();
-                        return eventResultBuffer.c_str();
-                    }
-                    if (command == "keymapget") {
-                        auto keymap = wmouse.getButtonMap();
-                        std::stringstream ss;
-                        ss << "OK:";
-                        for (auto& mapping : keymap) {
-                            ss << mapping.first.toProtocolString()
-                                << ":" << mapping.second << ":";
-                        }
-                        eventResultBuffer = ss.str();
-                        eventResultBuffer.pop_back(); // remove trailing ':'
-                        return eventResultBuffer.c_str();
-                    }
-                    if (command == "bindkey") {
-                        if (parameters.size() != 3) {
-                            return "ERROR:Invalid parameter count";
-                        }
-
-                        WiimoteButton wiiButton = configButtonNameToWiimote(
-                            parameters[0]
-                        );
-                        if (wiiButton == WiimoteButton::INVALID) {
-                            return "ERROR:Invalid wii button";
-                        }
-
-                        bool ir;
-                        if (parameters[1] == "0") {
-                            ir = false;
-                        } else if (parameters[1] == "1") {
-                            ir = true;
-                        } else {
-                            return "ERROR:Invalid ir value";
-                        }
-
-                        std::string keyName = trim(parameters[2]);
-                        const SupportedButton* key = findButtonByName(keyName);
-                        if ((!key) && (keyName != "")) {
-                            return "ERROR:Invalid key binding";
-                        }
-
-                        wmouse.mapButton(wiiButton, ir, key);
-
-                        const WiimoteButtonMappingState state = {wiiButton, ir};
-                        config.stringOptions[state.toConfigurationKey()] = keyName;
-                        config.writeConfigFile();
-                        return "OK";
-                    }
-                    if (command == "irdist100") {
-                        if (parameters.size() != 1) {
-                            return "ERROR:Invalid parameter count";
-                        }
-                        int64_t distance;
-                        try {
-                            distance = std::stoll(parameters[0]);
-                        }
-                        catch (std::exception& e) {
-                            return "ERROR:Invalid parameter";
-                        }
-                        if (distance < 0) {
-                            return "ERROR:Invalid parameter";
-                        }
-                        wmouse.setClusteringDefaultDistance(distance / 100.0f);
-                        config.stringOptions["default_ir_distance"] = parameters[0];
-                        config.writeConfigFile();
-                        return "OK";
-                    }
-                    if (command == "calibration") {
-                        if (parameters.size() != 1) {
-                            return "ERROR:Invalid parameter count";
-                        }
-                        wmouse.setCalibrationMode(parameters[0] == "on");
-                    }
-                    if (command == "getsmoothing100") {
-                        Vector3 sVec = getConfSmootingVector(wmouse);
-
-                        std::stringstream ss;
-                        ss << "OK:" 
-                            << sVec.values[0].redivide(100).value
-                            << ":" << sVec.values[1].redivide(100).value
-                            << ":" << sVec.values[2].redivide(100000).value;
-                        eventResultBuffer = ss.str();
-                        return eventResultBuffer.c_str();
-                    }
-                    if (command == "setsmoothing100") {
-                        if (parameters.size() != 3) {
-                            return "ERROR:Invalid parameter count";
-                        }
-                        Scalar smoothingClicked, smoothingReleased, clickFreeze;
-                        try {
-                            smoothingClicked = Scalar(
-                                std::stoll(parameters[0]), 100
-                            );
-                            smoothingReleased = Scalar(
-                                std::stoll(parameters[1]), 100
-                            );
-                            clickFreeze = Scalar(
-                                std::stoll(parameters[2]), 100000
-                            );
-                        }
-                        catch (std::exception& e) {
-                            return "ERROR:Invalid parameter";
-                        }
-
-                        if (clickFreeze < 0) {
-                            return "ERROR:Click freeze negative";
-                        }
-                        if ((smoothingClicked > 0) || (smoothingReleased > 0)) {
-                            return "ERROR:Log smoothing factors larger than 0";
-                        }
-
-                        wmouse.setSmoothingFactors(
-                            pow(10.0f, smoothingClicked.toFloat()),
-                            pow(10.0f, smoothingReleased.toFloat()),
-                            clickFreeze.toFloat()
-                        );
-                        config.vectorOptions[
-                            "smoothing_clicked_released_delay"
-                        ] = Vector3(
-                            smoothingClicked, smoothingReleased, clickFreeze
-                        ).redivide(100000);
-                        config.writeConfigFile();
-                        return "OK";
-                    }
-                    if (command == "gettcradius10000") {
-                        std::stringstream ss;
-                        ss << "OK:" << (int) (wmouse.getToweredCircleRadius() * 10000);
-                        eventResultBuffer = ss.str();
-                        return eventResultBuffer.c_str();
-                    }
-                    if (command == "settcradius10000") {
-                        if (parameters.size() != 1) {
-                            return "ERROR:Invalid parameter count";
-                        }
-                        int64_t radius;
-                        try {
-                            radius = std::stoll(parameters[0]);
-                        }
-                        catch (std::exception& e) {
-                            return "ERROR:Invalid parameter";
-                        }
-                        if (radius < 0) {
-                            return "ERROR:Invalid parameter";
-                        }
-                        if (radius > 10000) {
-                            radius = 10000;
-                        }
-                        wmouse.setToweredCircleRadius(radius / 10000.0f);
-                        config.stringOptions["towed_circle_radius"] = std::to_string(radius);
-                        config.writeConfigFile();
-                        return "OK";
-                    }
-                    return "ERROR:Invalid command";
-                }
-            );
+            if (wmouse.profileSwitchChordPressed()) {
+                switchProfile(wmouse, config, wmouse.getNextProfile());
+            }
+            telemetry.processingMicros = (int32_t) (realtimeMicros() - processingStartTime);
+            record.processingMicros = telemetry.processingMicros;
+            flightRecorder.commit();
+
+            // Writing a dump takes longer than a frame, the frame after it
+            // does not count as an overrun
+            const int64_t jumpThreshold = config.settings.integer(SettingKey::FlightRecorderJumpThreshold);
+            bool dumped = serveFlightDumpSignal(flightRecorder, config);
+            if (overrun) {
+                dumped |= dumpFlightRecorderOnAnomaly(flightRecorder, config, "overrun");
+            } else if ((jumpThreshold > 0) && flightRecorder.cursorJumped(jumpThreshold)) {
+                dumped |= dumpFlightRecorderOnAnomaly(flightRecorder, config, "jump");
+            }
+            if (dumped) {
+                nextFrame = std::chrono::steady_clock::now();
+            }
 
-            // Send raw ir data
+            telemetry.sequence++;
+            telemetry.timestamp = realtimeMicros();
             for (int i = 0; i < 4; i++) {
                 IRData d = wmouse.getIrSpot(i);
-                snprintf(
-                    irMessageBuffer,
-                    1024,
-                    "ir:%i:%i:%i:%i\n",
-                    i,
-                    (int) d.valid,
-                    (int) d.point.values[0].undivide().value,
-                    (int) d.point.values[1].undivide().value
-                );
-                csocket.broadcastMessage(irMessageBuffer);
-            }
-
-            // Send clustered left/right data
-            if (wmouse.hasValidLeftRight()) {
-                {
-                    const Vector3 left = wmouse.getClusteringLeftPoint();
-                    const Vector3 right = wmouse.getClusteringRightPoint();
-                    snprintf(
-                        irMessageBuffer,
-                        1024,
-                        "lr:%i:%i:%i:%i\n",
-                        (int) left.values[0].value,
-                        (int) left.values[1].value,
-                        (int) right.values[0].value,
-                        (int) right.values[1].value
-                    );
-                    csocket.broadcastMessage(irMessageBuffer);
-                }
+                telemetry.irValid[i] = d.valid;
+                telemetry.irPoints[i][0] = (int) d.point.values[0].undivide().value;
+                telemetry.irPoints[i][1] = (int) d.point.values[1].undivide().value;
+            }
 
-                {
-                    Vector3f fleft, fright;
-                    wmouse.getFilteredLrPoints(fleft, fright);
-                    snprintf(
-                        irMessageBuffer,
-                        1024,
-                        "flr:%i:%i:%i:%i\n",
-                        (int) fleft.values[0],
-                        (int) fleft.values[1],
-                        (int) fright.values[0],
-                        (int) fright.values[1]
-                    );
-                    csocket.broadcastMessage(irMessageBuffer);
-                }
-            } else {
-                csocket.broadcastMessage("lr:invalid\n");
-                csocket.broadcastMessage("flr:invalid\n");
-            }
-
-            if (buttonStates != wmouse.getButtonStates()) {
-                buttonStates = wmouse.getButtonStates();
-                snprintf(
-                    irMessageBuffer,
-                    1024,
-                    "b:%s\n",
-                    buttonStates.toMsgState().c_str()
-                );
-                csocket.broadcastMessage(irMessageBuffer);
+            telemetry.lrValid = wmouse.hasValidLeftRight();
+            if (telemetry.lrValid) {
+                const Vector3 left = wmouse.getClusteringLeftPoint();
+                const Vector3 right = wmouse.getClusteringRightPoint();
+                telemetry.lr[0] = (int) left.values[0].value;
+                telemetry.lr[1] = (int) left.values[1].value;
+                telemetry.lr[2] = (int) right.values[0].value;
+                telemetry.lr[3] = (int) right.values[1].value;
+
+                Vector3f fleft, fright;
+                wmouse.getFilteredLrPoints(fleft, fright);
+                telemetry.flr[0] = (int) fleft.values[0];
+                telemetry.flr[1] = (int) fleft.values[1];
+                telemetry.flr[2] = (int) fright.values[0];
+                telemetry.flr[3] = (int) fright.values[1];
+            }
+
+            telemetry.cursorValid = wmouse.getCursor(telemetry.cursor[0], telemetry.cursor[1]);
+
+            telemetry.buttons = wmouse.getButtonStates();
+            wmouse.getAccel(telemetry.accel[0], telemetry.accel[1], telemetry.accel[2]);
+
+            telemetry.formatTopics(asciiTelemetry);
+            telemetry.topicValues(telemetryValues);
+            binaryTelemetry.clear();
+            telemetry.encodeBinary(binaryTelemetry);
+            if (telemetryRing) {
+                telemetryRing->publish(binaryTelemetry.data());
             }
+            csocket.broadcastTelemetry(
+                asciiTelemetry, telemetryValues, binaryTelemetry, telemetry.timestamp
+            );
         }
+
+        connectedMouse = nullptr;
     }
 
     std::cout << "Mouse driver stopped!" << std::endl;
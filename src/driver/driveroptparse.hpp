@@ -61,6 +61,8 @@ public:
 const static char* VALID_COMMANDLINE_OPTIONS[] = {
     "socket-path",
     "config-file",
+    "output",
+    "replay",
     "help",
     "version",
     nullptr
@@ -69,6 +71,8 @@ const static char* VALID_COMMANDLINE_OPTIONS[] = {
 const static char* COMMANDLINE_OPTIONS_WITH_ARG[] = {
     "socket-path",
     "config-file",
+    "output",
+    "replay",
     nullptr
 };
 
@@ -77,6 +81,12 @@ R"(Usage: xwiimote-mouse-driver [options]
 Options:
     --socket-path=<path>  Path to the control socket
     --config-file=<path>  Path to the config file
+    --output=<output>     Where mouse events go: "uinput" (default), "null"
+                          to discard them, or a file path to record them
+    --replay=<path>       Run a flight recorder dump through the filters with
+                          the settings of the config file and print the
+                          recorded and replayed cursor positions as CSV.
+                          Mouse events are discarded unless --output is set.
     --help                Print this help message
     --version             Print the version number
 )";
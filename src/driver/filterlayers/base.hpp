@@ -31,6 +31,7 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include "../floatlinalg.hpp"
 #include "../virtualmouse.hpp"
 #include "../driverextra.hpp"
+#include "../device.hpp"
 
 enum class ProcessingOutputHistoryPoint {
     Cluster = 0,
@@ -38,17 +39,12 @@ enum class ProcessingOutputHistoryPoint {
 };
 
 class WiiMouseProcessingModule {
-public:
-    static const int MAX_BUTTONS = 32;
 protected:
     void copyFromPrev(const WiiMouseProcessingModule& prev) {
         history = prev.history;
         deltaT = prev.deltaT;
-        std::copy(
-            prev.pressedButtons, 
-            prev.pressedButtons + MAX_BUTTONS, 
-            pressedButtons
-        );
+        wiiButtons = prev.wiiButtons;
+        pressedKeys = prev.pressedKeys;
         nValidIrSpots = prev.nValidIrSpots;
         std::copy(
             prev.trackingDots, 
@@ -62,21 +58,22 @@ public:
 
     std::map<ProcessingOutputHistoryPoint, const WiiMouseProcessingModule*> history;
 
-    NamespacedButtonState pressedButtons[MAX_BUTTONS];
+    WiimoteButtonSet wiiButtons;
+    EvdevKeySet pressedKeys;
 
     int nValidIrSpots;
     Vector3f trackingDots[4];
     Vector3f accelVector;
 
     bool isButtonPressed(ButtonNamespace ns, int buttonId) const {
-        const auto searchFor = NamespacedButtonState(ns, buttonId, false);
-        for (int i = 0; i < MAX_BUTTONS; i++) {
-            if (!pressedButtons[i]) {
-                break;
-            }
-            if (pressedButtons[i].matches(searchFor)) {
-                return pressedButtons[i].state;
-            }
+        if (buttonId < 0) {
+            return false;
+        }
+        if ((ns == ButtonNamespace::WII) && (buttonId < (int) wiiButtons.size())) {
+            return wiiButtons[buttonId];
+        }
+        if ((ns == ButtonNamespace::VMOUSE) && (buttonId < (int) pressedKeys.size())) {
+            return pressedKeys[buttonId];
         }
         return false;
     }
@@ -66,104 +66,65 @@ static bool operator<(
 }
 
 
-class WMPButtonMapper : public WiiMouseProcessingModule {
-private:
-    std::map<WiimoteButtonMappingState, std::vector<int>> wiiToEvdevMap;
-public:
+struct WMPButtonMapperParameters {
+    // Keys pressed by every wiimote button, indexed by wiimote button and
+    // ir visibility
+    EvdevKeySet keyTable[(int) WiimoteButton::COUNT][2];
+
     void clearButtonAssignments(WiimoteButton wiiButton, bool ir) {
-        WiimoteButtonMappingState key = {wiiButton, ir};
-        wiiToEvdevMap.erase(key);
+        keyTable[(int) wiiButton][ir].reset();
     }
 
     void clearMapping() {
-        wiiToEvdevMap.clear();
+        for (auto& perButton : keyTable) {
+            perButton[0].reset();
+            perButton[1].reset();
+        }
     }
 
     void addMapping(WiimoteButton wiiButton, bool ir, int evdevButton) {
-        WiimoteButtonMappingState key = {wiiButton, ir};
-        auto& v = wiiToEvdevMap[key];
-        if (std::find(v.begin(), v.end(), evdevButton) != v.end()) {
-            return;
+        EvdevKeySet& keys = keyTable[(int) wiiButton][ir];
+        if ((evdevButton >= 0) && (evdevButton < (int) keys.size())) {
+            keys.set(evdevButton);
         }
-        v.push_back(evdevButton);
     }
 
     std::map<WiimoteButtonMappingState, std::string> getStringMappings() const {
         std::map<WiimoteButtonMappingState, std::string> result;
-        for (auto& mapping : wiiToEvdevMap) {
-            for (int evdevButton : mapping.second) {
-                const SupportedButton* btn = findButtonByCode(evdevButton);
-                if (btn) {
-                    result[mapping.first] = btn->rawKeyName;
-                    break;                    
+        for (int button = 0; button < (int) WiimoteButton::COUNT; button++) {
+            for (int ir = 0; ir < 2; ir++) {
+                const EvdevKeySet& keys = keyTable[button][ir];
+                for (int evdevButton = 0; keys.any() && (evdevButton < (int) keys.size()); evdevButton++) {
+                    const SupportedButton* btn = keys[evdevButton] ? findButtonByCode(evdevButton) : nullptr;
+                    if (btn) {
+                        result[{(WiimoteButton) button, ir == 1}] = btn->rawKeyName;
+                        break;
+                    }
                 }
             }
         }
         return result;
     }
+};
 
-    virtual void process(const WiiMouseProcessingModule& prev) override {
-        std::vector<int> lastPressedButtons;
-        for (int i = 0; i < MAX_BUTTONS; i++) {
-            if (!pressedButtons[i]) {
-                break;
-            }
-            if ((pressedButtons[i].ns == ButtonNamespace::VMOUSE) && pressedButtons[i].state) {
-                lastPressedButtons.push_back(pressedButtons[i].buttonId);
-            }
-        }
+class WMPButtonMapper : public WiiMouseProcessingModule {
+private:
+    WMPButtonMapperParameters parameters;
+public:
+    // Called at the start of a frame
+    void setParameters(const WMPButtonMapperParameters& parameters) {
+        this->parameters = parameters;
+    }
 
+    virtual void process(const WiiMouseProcessingModule& prev) override {
         copyFromPrev(prev);
 
-        int assignedButtons = 0;
-        for (auto& button : prev.pressedButtons) {
-            if (assignedButtons >= MAX_BUTTONS) {
-                break;
-            }
-            if (!button || (button.ns != ButtonNamespace::WII)) {
-                break;
-            }
-            WiimoteButtonMappingState key = {
-                (WiimoteButton) button.buttonId, prev.nValidIrSpots > 0
-            };
-            if (button.ns == ButtonNamespace::WII) {
-                if (!button.state) {
-                    continue;
-                }
-                auto mapping = wiiToEvdevMap.find(key);
-                if (mapping == wiiToEvdevMap.end()) {
-                    continue;
-                }
-                for (int evdevButton : mapping->second) {
-                    if (assignedButtons >= MAX_BUTTONS) {
-                        break;
-                    }
-                    pressedButtons[assignedButtons++] = NamespacedButtonState(
-                        ButtonNamespace::VMOUSE, evdevButton, button.state
-                    );
-                    lastPressedButtons.erase(
-                        std::remove(
-                            lastPressedButtons.begin(),
-                            lastPressedButtons.end(),
-                            evdevButton
-                        ),
-                        lastPressedButtons.end()
-                    );
-                }
-            }
-        }
-
-        for (int evdevButton : lastPressedButtons) {
-            if (assignedButtons >= MAX_BUTTONS) {
-                break;
+        const int ir = (prev.nValidIrSpots > 0) ? 1 : 0;
+        pressedKeys.reset();
+        for (int i = 0; i < (int) WiimoteButton::COUNT; i++) {
+            if (wiiButtons[i]) {
+                pressedKeys |= parameters.keyTable[i][ir];
             }
-            pressedButtons[assignedButtons++] = NamespacedButtonState(
-                ButtonNamespace::VMOUSE, evdevButton, false
-            );
-        }
-
-        if (assignedButtons < MAX_BUTTONS) {
-            pressedButtons[assignedButtons++] = NamespacedButtonState::NONE;
         }
     }
 };
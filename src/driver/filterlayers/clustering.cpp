@@ -16,109 +16,111 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 #include "clustering.hpp"
 
+// Number of two-way partitions of four points. Point 0 always lands in the
+// first cluster, bit i-1 of the mask moves point i into the second one.
+static const int PARTITION_COUNT = 7;
+
+static constexpr float INVALID_PARTITION_SCORE = 1e30f;
+
+static float squaredDistance(float ax, float ay, float bx, float by) {
+    return (ax - bx) * (ax - bx) + (ay - by) * (ay - by);
+}
+
 void IrSpotClustering :: processIrSpots(const IRData* irSpots) {
     int noValid = 0;
-    const IRData* validList[4];
-    std::fill(validList, validList + 4, nullptr);
+    float px[4] = {0, 0, 0, 0};
+    float py[4] = {0, 0, 0, 0};
+    float weight[4] = {0, 0, 0, 0};
     for (int i = 0; i < 4; i++) {
         if (irSpots[i].valid) {
-            validList[noValid] = irSpots + i;
+            px[noValid] = irSpots[i].point.values[0].toFloat();
+            py[noValid] = irSpots[i].point.values[1].toFloat();
+            weight[noValid] = 1.0f;
             noValid++;
         }
     }
 
-    Scalar distanceMatrix[4][4];
-    for (int i = 0; i < noValid; i++) {
-        for (int j = 0; j < noValid; j++) {
-            if (i > j) {
-                distanceMatrix[i][j] = distanceMatrix[j][i];
-            } else if (i == j) {
-                distanceMatrix[i][j] = 0;
-            } else {
-                distanceMatrix[i][j] = (validList[i]->point - validList[j]->point).len();
-            }
-        }
+    if (noValid == 0) {
+        valid = false;
+        return;
     }
+    if (noValid == 1) {
+        valid = true;
+        rightPoint = leftPoint = Vector3f(px[0], py[0], 0).toVector3(100);
+        return;
+    }
+
+    // Scores every partition by its within-cluster scatter (which is the
+    // same as rewarding a large spacing between the two centroids) plus
+    // how far the centroids moved relative to the last frame. Invalid
+    // slots carry zero weight so the amount of work is always the same.
+    const float prevLx = leftPoint.values[0].toFloat();
+    const float prevLy = leftPoint.values[1].toFloat();
+    const float prevRx = rightPoint.values[0].toFloat();
+    const float prevRy = rightPoint.values[1].toFloat();
+    const bool hasPrevious = valid;
+    const float temporalWeight = hasPrevious ? previousFrameWeight : 0.0f;
 
-    switch (noValid) {
-        case 1:
-            valid = true;
-            rightPoint = leftPoint = validList[0]->point;
-            break;
-        case 2:
-        case 3:
-        case 4:
-            {
-                valid = true;
-            
-                // do a quick two-iterations k-means clustering
-                Vector3 clusterPoints[2] = {
-                    leftPoint.redivide(100),
-                    rightPoint.redivide(100)
-                };
-                if (leftPoint == rightPoint) {
-                    clusterPoints[1] = rightPoint + Vector3(1, 0, 0);
-                }
-
-                for (int _iter = 0; _iter < 2; _iter++) {
-                    Vector3 clusterSums[2] = {Vector3(), Vector3()};
-                    int clusterCounts[2] = {0, 0};
-
-                    for (int i = 0; i < noValid; i++) {
-                        int closestCluster = -1;
-                        Scalar closestDistance = 0L;
-                        for (int c = 0; c < 2; c++) {
-                            Scalar d = (validList[i]->point - clusterPoints[c]).len();
-
-                            if ((d < closestDistance) || (closestCluster < 0)) {
-                                closestDistance = d;
-                                closestCluster = c;
-                            }
-                        }
-
-                        clusterSums[closestCluster] = clusterSums[closestCluster] + validList[i]->point;
-                        clusterCounts[closestCluster]++;
-                    }
-
-                    for (int i = 0; i < 2; i++) {
-                        if (clusterCounts[i] > 0) {
-                            clusterPoints[i] = clusterSums[i] / clusterCounts[i];
-                        }
-                        clusterPoints[i] = clusterPoints[i].redivide(100);
-                    }
-
-                    // if one of the two clusters is empty, we assign a point
-                    // from the filled cluster that is furthest away from the
-                    // newly computed clusterPoint
-                    if (clusterCounts[0] == 0) {
-                        clusterCounts[0] = clusterCounts[1];
-                        clusterPoints[0] = clusterPoints[1];
-                        clusterCounts[1] = 0;
-                    }
-                    if (clusterCounts[1] == 0) {
-                        Scalar maxDistance = 0;
-                        int maxDistanceIndex = 0;
-                        for (int i = 0; i < noValid; i++) {
-                            Scalar d = (validList[i]->point - clusterPoints[0]).len();
-                            if (d > maxDistance) {
-                                maxDistance = d;
-                                maxDistanceIndex = i;
-                            }
-                        }
-                        clusterPoints[1] = validList[maxDistanceIndex]->point.redivide(100);
-                    }
-                }
-
-                leftPoint = clusterPoints[0].undivide();
-                rightPoint = clusterPoints[1].undivide();
-            }
-            break;
-        default:
-            valid = false;
-            break;
+    float totalN = 0, totalX = 0, totalY = 0, totalSq = 0;
+    for (int i = 0; i < 4; i++) {
+        totalN += weight[i];
+        totalX += weight[i] * px[i];
+        totalY += weight[i] * py[i];
+        totalSq += weight[i] * (px[i] * px[i] + py[i] * py[i]);
     }
+
+    float bestScore = INVALID_PARTITION_SCORE * 2.0f;
+    float best[4] = {0, 0, 0, 0};
+    bool bestSwapped = false;
+    for (int mask = 1; mask <= PARTITION_COUNT; mask++) {
+        float nB = 0, sumBx = 0, sumBy = 0;
+        for (int i = 1; i < 4; i++) {
+            const float inB = (float) ((mask >> (i - 1)) & 1) * weight[i];
+            nB += inB;
+            sumBx += inB * px[i];
+            sumBy += inB * py[i];
+        }
+        const float nA = totalN - nB;
+
+        const float ax = (totalX - sumBx) / maxf(nA, 1.0f);
+        const float ay = (totalY - sumBy) / maxf(nA, 1.0f);
+        const float bx = sumBx / maxf(nB, 1.0f);
+        const float by = sumBy / maxf(nB, 1.0f);
+
+        const float scatter = totalSq 
+            - nA * (ax * ax + ay * ay) 
+            - nB * (bx * bx + by * by);
+
+        const float straight = squaredDistance(ax, ay, prevLx, prevLy) 
+            + squaredDistance(bx, by, prevRx, prevRy);
+        const float swapped = squaredDistance(ax, ay, prevRx, prevRy) 
+            + squaredDistance(bx, by, prevLx, prevLy);
+
+        const float score = scatter 
+            + temporalWeight * minf(straight, swapped)
+            + ((nB < 0.5f) ? INVALID_PARTITION_SCORE : 0.0f);
+
+        const bool better = score < bestScore;
+        bestScore = better ? score : bestScore;
+        best[0] = better ? ax : best[0];
+        best[1] = better ? ay : best[1];
+        best[2] = better ? bx : best[2];
+        best[3] = better ? by : best[3];
+        // Without a usable previous frame, the left side is the one with the
+        // smaller x coordinate
+        const bool swap = hasPrevious
+            ? ((swapped < straight) || ((swapped == straight) && (bx < ax)))
+            : (bx < ax);
+        bestSwapped = better ? swap : bestSwapped;
+    }
+
+    valid = true;
+    const Vector3f first(best[0], best[1], 0);
+    const Vector3f second(best[2], best[3], 0);
+    leftPoint = (bestSwapped ? second : first).toVector3(100);
+    rightPoint = (bestSwapped ? first : second).toVector3(100);
 }
 
-IrSpotClustering :: IrSpotClustering() : defaultDistance(300) {
+IrSpotClustering :: IrSpotClustering() : previousFrameWeight(0.1f) {
     valid = false;
 }
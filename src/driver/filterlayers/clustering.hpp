@@ -35,23 +35,41 @@ public:
     Vector3 leftPoint;
     Vector3 rightPoint;
 
-    float defaultDistance;
+    // Weight of the squared centroid displacement relative to the last
+    // frame when scoring a partition. Keeps the split and the left/right
+    // assignment stable when the spatial layout is ambiguous.
+    float previousFrameWeight;
 
     void processIrSpots(const IRData* irSpots);
     IrSpotClustering();
 };
 
+struct WMPClusteringParameters {
+    // Merges the left and right point if they are closer than half the
+    // default distance
+    bool enablePointCollapse;
+    float defaultDistance;
+
+    WMPClusteringParameters() {
+        enablePointCollapse = true;
+        defaultDistance = 100.0;
+    }
+};
+
 class WMPClustering : public WiiMouseProcessingModule {
 private:
+    WMPClusteringParameters parameters;
 public:
-    bool enablePointCollapse;
     IRData irData[4];
     IrSpotClustering irSpotClustering;
 
+    // Called at the start of a frame
+    void setParameters(const WMPClusteringParameters& parameters) {
+        this->parameters = parameters;
+    }
+
     WMPClustering() {
         std::fill(irData, irData + 4, INVALID_IR);
-        irSpotClustering.defaultDistance = 100.0;
-        enablePointCollapse = true;
     }
 
     void process(const WiiMouseProcessingModule& prev) {
@@ -74,8 +92,8 @@ public:
             trackingDots[0] = irSpotClustering.leftPoint;
             trackingDots[1] = irSpotClustering.rightPoint;
 
-            if (enablePointCollapse) {
-                const float threshold = 0.5f * irSpotClustering.defaultDistance;
+            if (parameters.enablePointCollapse) {
+                const float threshold = 0.5f * parameters.defaultDistance;
                 if ((trackingDots[0] - trackingDots[1]).len() < threshold) {
                     nValidIrSpots = 1;
                     trackingDots[0] = (trackingDots[0] + trackingDots[1]) / 2.0f;
@@ -31,37 +31,37 @@ void WMPSmoother :: process(const WiiMouseProcessingModule& prev) {
     
     float posMix, accelMix;
     if (buttonIsPressed) {
-        accelMix = pow(accelMixFactorClicked, deltaT / 1000.0f);
+        accelMix = pow(parameters.accelMixFactorClicked, deltaT / 1000.0f);
         if (!buttonWasPressed) {
-            clickReleaseTimer = clickReleaseBlendDelay + clickReleaseFreezeDelay;
+            clickReleaseTimer = parameters.clickReleaseBlendDelay + parameters.clickReleaseFreezeDelay;
         }
-        clickReleaseTimer = maxf(clickReleaseTimer, clickReleaseBlendDelay);
+        clickReleaseTimer = maxf(clickReleaseTimer, parameters.clickReleaseBlendDelay);
     } else {
-        accelMix = pow(accelMixFactor, deltaT / 1000.0f);
-        clickReleaseTimer = minf(clickReleaseTimer, clickReleaseBlendDelay);
+        accelMix = pow(parameters.accelMixFactor, deltaT / 1000.0f);
+        clickReleaseTimer = minf(clickReleaseTimer, parameters.clickReleaseBlendDelay);
     }
     buttonWasPressed = buttonIsPressed;
 
     if (clickReleaseTimer <= 0) {
-        posMix = positionMixFactor;
+        posMix = parameters.positionMixFactor;
     } else if (
-        (clickReleaseFreezeDelay > 0) && 
-        (clickReleaseTimer > clickReleaseBlendDelay)
+        (parameters.clickReleaseFreezeDelay > 0) && 
+        (clickReleaseTimer > parameters.clickReleaseBlendDelay)
     ) {
         posMix = 1;
-    } else if (clickReleaseBlendDelay <= 0) {
+    } else if (parameters.clickReleaseBlendDelay <= 0) {
         if (buttonIsPressed) {
-            posMix = positionMixFactorClicked;
+            posMix = parameters.positionMixFactorClicked;
         } else {
-            posMix = positionMixFactor;
+            posMix = parameters.positionMixFactor;
         }
     } else {
-        const float m = clickReleaseTimer / clickReleaseBlendDelay;
-        posMix = positionMixFactor * (1.0f - m) + positionMixFactorClicked * m;
+        const float m = clickReleaseTimer / parameters.clickReleaseBlendDelay;
+        posMix = parameters.positionMixFactor * (1.0f - m) + parameters.positionMixFactorClicked * m;
     }
     posMix = pow(posMix, deltaT / 1000.0f);
 
-    if (hasPosition && enabled) {
+    if (hasPosition && parameters.enabled) {
         for (int i = 0; i < 4; i++) {
             trackingDots[i] = lastPositions[i] = (
                 (trackingDots[i] * (1.0f - posMix)) + 
@@ -70,7 +70,7 @@ void WMPSmoother :: process(const WiiMouseProcessingModule& prev) {
         }
     }
 
-    if (hasAccel && enabled) {
+    if (hasAccel && parameters.enabled) {
         accelVector = lastAccel = (
             (accelVector * (1.0f - accelMix)) +
             (lastAccel * accelMix)
@@ -18,8 +18,34 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 #include "base.hpp"
 
+struct WMPSmootherParameters {
+    bool enabled;
+
+    // influence of old values after 1 second
+    float positionMixFactor; 
+    float accelMixFactor; 
+    float positionMixFactorClicked;
+    float accelMixFactorClicked;
+    float clickReleaseBlendDelay;
+    float clickReleaseFreezeDelay;
+
+    WMPSmootherParameters() {
+        enabled = true;
+
+        accelMixFactor = 0.0f;
+        accelMixFactorClicked = 0.0f;
+
+        positionMixFactor = 0.00001f;
+        positionMixFactorClicked = 0.1f;
+        clickReleaseBlendDelay = 0.25f;
+        clickReleaseFreezeDelay = 0.1f;
+    }
+};
+
 class WMPSmoother : public WiiMouseProcessingModule {
 private:
+    WMPSmootherParameters parameters;
+
     bool hasAccel;
     Vector3f lastAccel;
 
@@ -29,32 +55,18 @@ private:
     bool buttonWasPressed;
     float clickReleaseTimer;
 public:
-    bool enabled;
-
-    // influence of old values after 1 second
-    float positionMixFactor; 
-    float accelMixFactor; 
-    float positionMixFactorClicked;
-    float accelMixFactorClicked;
-    float clickReleaseBlendDelay;
-    float clickReleaseFreezeDelay;
+    // Called at the start of a frame
+    void setParameters(const WMPSmootherParameters& parameters) {
+        this->parameters = parameters;
+    }
 
     virtual void process(const WiiMouseProcessingModule& prev) override;
 
     WMPSmoother() {
-        enabled = true;
         hasAccel = false;
         hasPosition = false;
 
         buttonWasPressed = false;
         clickReleaseTimer = 0.0f;
-
-        accelMixFactor = 0.0f;
-        accelMixFactorClicked = 0.0f;
-
-        positionMixFactor = 0.00001f;
-        positionMixFactorClicked = 0.1f;
-        clickReleaseBlendDelay = 0.25f;
-        clickReleaseFreezeDelay = 0.1f;
     }
 };
@@ -20,7 +20,7 @@ void WMPTowedCircle :: process(const WiiMouseProcessingModule& prev) {
     copyFromPrev(prev);
     history[ProcessingOutputHistoryPoint::LastLeftRight] = &prev;
 
-    if ((nValidIrSpots <= 0) || (radius <= 0)) {
+    if ((nValidIrSpots <= 0) || (parameters.radius <= 0)) {
         validCircle = false;
         return;
     }
@@ -35,12 +35,12 @@ void WMPTowedCircle :: process(const WiiMouseProcessingModule& prev) {
         circleCenter = center;
     } else {
         Vector3f delta = center - circleCenter;
-        delta[1] *= aspectRatio;
+        delta[1] *= parameters.aspectRatio;
         
-        float diff = delta.len() - radius * 1024.0f;
+        float diff = delta.len() - parameters.radius * 1024.0f;
         if (diff > 0.0) {
             delta = delta / delta.len() * diff;
-            delta[1] /= aspectRatio;
+            delta[1] /= parameters.aspectRatio;
             circleCenter += delta;
         }
     }
@@ -18,17 +18,30 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 #include "base.hpp"
 
+struct WMPTowedCircleParameters {
+    float radius, aspectRatio;
+
+    WMPTowedCircleParameters() {
+        radius = 0.005f;
+        aspectRatio = 1024.0f / 768.0f;
+    }
+};
+
 class WMPTowedCircle : public WiiMouseProcessingModule {
 private:
+    WMPTowedCircleParameters parameters;
+
     bool validCircle;
     Vector3f circleCenter;
 public:
-    float radius, aspectRatio;
+    // Called at the start of a frame
+    void setParameters(const WMPTowedCircleParameters& parameters) {
+        this->parameters = parameters;
+    }
 
     virtual void process(const WiiMouseProcessingModule& prev) override;
 
     WMPTowedCircle() {
-        radius = 0.005f;
-        aspectRatio = 1024.0f / 768.0f;
+        validCircle = false;
     }
 };
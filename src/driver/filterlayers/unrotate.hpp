@@ -20,55 +20,39 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 class WMPUnrotate : public WiiMouseProcessingModule {
 private:
-    void doUnrotate(const Vector3f& unrotateX, const Vector3f& unrotateY) {
-        const static Vector3f HALF_RES(
-            WIIMOTE_IR_SENSOR_EXTENTS.width / 2.0f,
-            WIIMOTE_IR_SENSOR_EXTENTS.height / 2.0f,
-            0
-        );
+    const Vector3f HALF_RES = Vector3f(
+        WIIMOTE_IR_SENSOR_EXTENTS.width / 2.0f,
+        WIIMOTE_IR_SENSOR_EXTENTS.height / 2.0f,
+        0
+    );
 
-        for (int i = 0; i < nValidIrSpots; i++) {
-            Vector3f dot = trackingDots[i] - HALF_RES;
-            dot = Vector3f(
-                dot.dot(unrotateX),
-                dot.dot(unrotateY),
-                0
-            );
-            trackingDots[i] = dot + HALF_RES;
-        }
-    }
-
-    void unrotateUsingAccel() {
-        // Takes the acceleration vector and unrotates the tracking dots
-        // to compensate for the rotation of the wiimote.
+    Matrix2x3f rollFromAccel() {
+        // Takes the acceleration vector and computes the rotation that
+        // compensates for the rotation of the wiimote.
         Vector3f normAccel = accelVector;
         normAccel[1] = 0;
         if (normAccel.len() <= 0.01) {
-            return;
+            return Matrix2x3f::identity();
         }
         normAccel = normAccel / accelVector.len();
 
         const Vector3f unrotateX(normAccel[2], normAccel[0], 0);
         const Vector3f unrotateY(-normAccel[0], normAccel[2], 0);
-        doUnrotate(unrotateX, unrotateY);
+        return Matrix2x3f::rotationAround(HALF_RES, unrotateX, unrotateY);
     }
 
-    void unrotateUsingDualPoint() {
-        // Takes the two tracking dots and unrotates the tracking dots
-        // to compensate for the rotation of the wiimote.
-        if (nValidIrSpots != 2) {
-            return;
-        }
-
-        Vector3f horizontal = trackingDots[1] - trackingDots[0];
+    Matrix2x3f rollFromDualPoint(const Vector3f& left, const Vector3f& right) const {
+        // Takes the two tracking dots and computes the rotation that
+        // levels them out horizontally.
+        Vector3f horizontal = right - left;
         if (horizontal.len() <= 0.01) {
-            return;
+            return Matrix2x3f::identity();
         }
         horizontal = horizontal / horizontal.len();
 
         const Vector3f unrotateX(horizontal[0], horizontal[1], 0);
-        const Vector3f unrotateY(-horizontal[1], horizontal[0], 0);        
-        doUnrotate(unrotateX, unrotateY);
+        const Vector3f unrotateY(-horizontal[1], horizontal[0], 0);
+        return Matrix2x3f::rotationAround(HALF_RES, unrotateX, unrotateY);
     }
 
     void assignLeftRight() {
@@ -81,12 +65,30 @@ private:
         }
     }
 public:
+    // Roll correction of the last processed frame. Both the accelerometer
+    // and the dual-point correction are folded into this single transform,
+    // so every dot is only transformed once.
+    Matrix2x3f rollTransform;
+
     virtual void process(const WiiMouseProcessingModule& prev) override {
         copyFromPrev(prev);
 
-        unrotateUsingAccel();
-        assignLeftRight();
-        unrotateUsingDualPoint();
+        rollTransform = rollFromAccel();
+        if (nValidIrSpots == 2) {
+            Vector3f left = rollTransform.apply(trackingDots[0]);
+            Vector3f right = rollTransform.apply(trackingDots[1]);
+            if (right[0] < left[0]) {
+                std::swap(left, right);
+                std::swap(trackingDots[0], trackingDots[1]);
+            }
+            rollTransform = rollFromDualPoint(left, right) * rollTransform;
+        }
+
+        // Later stages also read the slots behind the valid dots, they
+        // must be in the same coordinates
+        for (int i = 0; i < 4; i++) {
+            trackingDots[i] = rollTransform.apply(trackingDots[i]);
+        }
         assignLeftRight();
     }
 };
@@ -0,0 +1,121 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+
+#include "flightrecorder.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+bool FlightRecorder :: cursorJumped(int64_t threshold) const {
+    if (size() < 2) {
+        return false;
+    }
+    const FlightRecord& current = newest(0);
+    const FlightRecord& previous = newest(1);
+    if (!current.cursorValid || !previous.cursorValid) {
+        return false;
+    }
+    const int64_t dx = current.cursor[0] - previous.cursor[0];
+    const int64_t dy = current.cursor[1] - previous.cursor[1];
+    return dx * dx + dy * dy > threshold * threshold;
+}
+
+bool FlightRecorder :: allowAnomalyDump() {
+    if (anomalyDumped && (recorded - lastAnomalyDump < ring.size())) {
+        return false;
+    }
+    anomalyDumped = true;
+    lastAnomalyDump = recorded;
+    return true;
+}
+
+bool FlightRecorder :: dump(const std::string& path, const std::string& reason, const std::string& profile, std::string& error) const {
+    FlightDumpHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLIGHT_DUMP_MAGIC, sizeof(header.magic));
+    header.version = FLIGHT_DUMP_VERSION;
+    header.recordSize = sizeof(FlightRecord);
+    header.recordCount = (uint32_t) size();
+    strncpy(header.reason, reason.c_str(), sizeof(header.reason) - 1);
+    strncpy(header.profile, profile.c_str(), sizeof(header.profile) - 1);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        error = "Failed to open " + path;
+        return false;
+    }
+    file.write((const char*) &header, sizeof(header));
+    for (size_t age = size(); age > 0; age--) {
+        file.write((const char*) &newest(age - 1), sizeof(FlightRecord));
+    }
+    file.close();
+    if (!file) {
+        error = "Failed to write " + path;
+        return false;
+    }
+    return true;
+}
+
+FlightRecorder :: FlightRecorder(size_t capacity) : 
+    ring(std::max(capacity, (size_t) 2)),
+    recorded(0),
+    anomalyDumped(false),
+    lastAnomalyDump(0)
+{}
+
+bool readFlightDump(
+    const std::string& path, 
+    FlightDumpHeader& header, 
+    std::vector<FlightRecord>& records, 
+    std::string& error
+) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        error = "Failed to open " + path;
+        return false;
+    }
+    if (!file.read((char*) &header, sizeof(header))
+        || (memcmp(header.magic, FLIGHT_DUMP_MAGIC, sizeof(header.magic)) != 0)
+    ) {
+        error = "Not a flight recorder dump";
+        return false;
+    }
+    if ((header.version != FLIGHT_DUMP_VERSION) || (header.recordSize != sizeof(FlightRecord))) {
+        error = "Unsupported dump version";
+        return false;
+    }
+    header.reason[sizeof(header.reason) - 1] = 0;
+    header.profile[sizeof(header.profile) - 1] = 0;
+
+    // Checked before allocating, the count comes from the file
+    const std::streampos start = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff available = file.tellg() - start;
+    file.seekg(start);
+    if (available < (std::streamoff) header.recordCount * (std::streamoff) sizeof(FlightRecord)) {
+        error = "Dump is truncated";
+        return false;
+    }
+
+    records.resize(header.recordCount);
+    if (!file.read((char*) records.data(), (std::streamsize) header.recordCount * sizeof(FlightRecord))) {
+        error = "Dump is truncated";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,126 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Number of pipeline stages the flight recorder keeps the output of
+static const int FLIGHT_RECORDER_MAX_STAGES = 12;
+static const int DEFAULT_FLIGHT_RECORDER_SECONDS = 10;
+
+static constexpr char FLIGHT_DUMP_MAGIC[8] = {'W', 'M', 'F', 'L', 'I', 'G', 'H', 'T'};
+static const uint32_t FLIGHT_DUMP_VERSION = 1;
+
+// Raw wiimote input of one frame. A replay feeds it to the pipeline in
+// place of the wiimote.
+struct FrameInput {
+    // CLOCK_REALTIME microseconds when the frame started
+    int64_t time;
+    // Milliseconds since the previous frame
+    int32_t deltaT;
+    // IR reports received since the previous frame, ir only changes if
+    // there was at least one
+    int32_t irReports;
+    // As reported, 1023,1023 marks an invalid spot
+    int32_t ir[4][2];
+    int32_t accel[3];
+    // WiimoteButtonSet bits
+    uint32_t buttons;
+};
+
+// Spots left after a pipeline stage
+struct FlightStageOutput {
+    int32_t validSpots;
+    float dots[4][2];
+};
+
+struct FlightRecord {
+    FrameInput input;
+    int32_t stageCount;
+    FlightStageOutput stages[FLIGHT_RECORDER_MAX_STAGES];
+    int32_t cursorValid;
+    int32_t cursor[2];
+    // Reading the wiimote, the pipeline and writing the output
+    int32_t processingMicros;
+};
+
+// Dump files are this header followed by recordCount FlightRecords,
+// oldest first, in native byte order
+struct FlightDumpHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t recordCount;
+    // Zero terminated
+    char reason[20];
+    char profile[64];
+};
+
+// Always-on recording of the last frames for the analysis of glitches.
+// The frame loop fills the slot of the next frame in place, so recording
+// neither allocates nor locks. Recording and dumps both happen on the
+// main thread.
+class FlightRecorder {
+private:
+    std::vector<FlightRecord> ring;
+    uint64_t recorded;
+    bool anomalyDumped;
+    uint64_t lastAnomalyDump;
+public:
+    // Valid until the next commit
+    FlightRecord& next() {
+        return ring[recorded % ring.size()];
+    }
+    void commit() {
+        recorded++;
+    }
+
+    size_t size() const {
+        return recorded < ring.size() ? (size_t) recorded : ring.size();
+    }
+    // 0 is the frame committed last
+    const FlightRecord& newest(size_t age) const {
+        return ring[(recorded - 1 - age) % ring.size()];
+    }
+
+    // Whether the cursor moved further than threshold in absolute mouse
+    // coordinates between the last two frames
+    bool cursorJumped(int64_t threshold) const;
+
+    // Anomalies often come in bursts. Another automatic dump is only
+    // allowed once the ring holds no frame of the previous one.
+    bool allowAnomalyDump();
+
+    // Writes all recorded frames to a new file, returns false and sets
+    // error if that failed
+    bool dump(const std::string& path, const std::string& reason, const std::string& profile, std::string& error) const;
+
+    FlightRecorder(size_t capacity);
+};
+
+// Reads a file written by FlightRecorder::dump
+bool readFlightDump(
+    const std::string& path, 
+    FlightDumpHeader& header, 
+    std::vector<FlightRecord>& records, 
+    std::string& error
+);
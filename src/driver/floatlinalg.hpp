@@ -120,11 +120,57 @@ struct Vector3f {
     Vector3f(const Vector3f& other) = default;
 };
 
+// Affine 2d transform. Each row is applied as a dot product with (x, y, 1),
+// so the third column holds the translation.
+struct Matrix2x3f {
+    Vector3f rows[2];
+
+    Vector3f apply(const Vector3f& v) const {
+        const Vector3f h(v.values[0], v.values[1], 1.0f);
+        return Vector3f(rows[0].dot(h), rows[1].dot(h), 0);
+    }
+
+    // Composes two transforms: the result first applies `other`, then `this`
+    Matrix2x3f operator*(const Matrix2x3f& other) const {
+        Matrix2x3f result;
+        for (int r = 0; r < 2; r++) {
+            const Vector3f& row = rows[r];
+            result.rows[r] = Vector3f(
+                row[0] * other.rows[0][0] + row[1] * other.rows[1][0],
+                row[0] * other.rows[0][1] + row[1] * other.rows[1][1],
+                row[0] * other.rows[0][2] + row[1] * other.rows[1][2] + row[2]
+            );
+        }
+        return result;
+    }
+
+    static Matrix2x3f identity() {
+        return Matrix2x3f(Vector3f(1, 0, 0), Vector3f(0, 1, 0));
+    }
+
+    // Projects (p - center) onto the axes x and y and moves the result
+    // back to center
+    static Matrix2x3f rotationAround(const Vector3f& center, const Vector3f& x, const Vector3f& y) {
+        return Matrix2x3f(
+            Vector3f(x[0], x[1], center[0] - x[0] * center[0] - x[1] * center[1]),
+            Vector3f(y[0], y[1], center[1] - y[0] * center[0] - y[1] * center[1])
+        );
+    }
+
+    Matrix2x3f() : Matrix2x3f(identity()) {}
+    Matrix2x3f(const Vector3f& row0, const Vector3f& row1) : rows{row0, row1} {}
+};
+
 static std::ostream& operator<<(std::ostream& out, const Vector3f& v) {
     out << "Vector3f(x=" << v.values[0] << " y=" << v.values[1] << " z=" << v.values[2] << ")";
     return out;
 }
 
+static std::ostream& operator<<(std::ostream& out, const Matrix2x3f& m) {
+    out << "Matrix2x3f(" << m.rows[0] << ", " << m.rows[1] << ")";
+    return out;
+}
+
 static constexpr float clamp(float v, float min, float max) {
     return (v < min) ? min : ((v > max) ? max : v);
 }
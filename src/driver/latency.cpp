@@ -0,0 +1,106 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#include "latency.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+
+int LatencyHistogram :: bucketIndex(int64_t us) {
+    if (us < SUB_BUCKETS) {
+        return (int) std::max(us, (int64_t) 0);
+    }
+    // us lies in [2^octave, 2^(octave + 1)), the two bits after the
+    // leading one select the sub-bucket
+    const int octave = 63 - __builtin_clzll((uint64_t) us);
+    const int sub = (int) ((us >> (octave - 2)) & (SUB_BUCKETS - 1));
+    return std::min((octave - 1) * SUB_BUCKETS + sub, BUCKETS - 1);
+}
+
+int64_t LatencyHistogram :: bucketUpperBound(int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const int octave = index / SUB_BUCKETS + 1;
+    const int sub = index % SUB_BUCKETS;
+    return (((int64_t) SUB_BUCKETS + 1 + sub) << (octave - 2)) - 1;
+}
+
+void LatencyHistogram :: record(int64_t us) {
+    // Clock adjustments can produce negative durations
+    us = std::max(us, (int64_t) 0);
+    buckets[bucketIndex(us)]++;
+    count++;
+    sum += us;
+    max = std::max(max, us);
+}
+
+void LatencyHistogram :: reset() {
+    std::fill(buckets, buckets + BUCKETS, 0);
+    count = 0;
+    sum = 0;
+    max = 0;
+}
+
+int64_t LatencyHistogram :: mean() const {
+    if (count == 0) {
+        return 0;
+    }
+    return sum / (int64_t) count;
+}
+
+int64_t LatencyHistogram :: percentile(float p) const {
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t target = std::max((uint64_t) std::ceil(p * count), (uint64_t) 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return std::min(bucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+
+std::string LatencyProbe :: toProtocolString() const {
+    const std::pair<const char*, const LatencyHistogram*> histograms[] = {
+        {"total", &total},
+        {"queue", &queueing},
+        {"processing", &processing},
+        {"output", &output}
+    };
+
+    std::stringstream ss;
+    bool first = true;
+    for (auto& entry : histograms) {
+        if (!first) {
+            ss << ":";
+        }
+        first = false;
+
+        const LatencyHistogram& h = *entry.second;
+        ss << entry.first
+            << ":" << h.getCount()
+            << ":" << h.mean()
+            << ":" << h.percentile(0.5f)
+            << ":" << h.percentile(0.99f)
+            << ":" << h.getMax();
+    }
+    return ss.str();
+}
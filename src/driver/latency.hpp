@@ -0,0 +1,102 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <string>
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+// Input events from the kernel carry CLOCK_REALTIME timestamps, so all
+// latency measurements use the same clock.
+static inline int64_t realtimeMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((int64_t) ts.tv_sec) * 1000000L + ts.tv_nsec / 1000L;
+}
+
+static inline int64_t timevalToMicros(const timeval& tv) {
+    return ((int64_t) tv.tv_sec) * 1000000L + tv.tv_usec;
+}
+
+// Log-linear histogram of durations in microseconds. Every power of two
+// is split into 4 buckets, so percentiles are accurate to within 25%.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKETS = 4;
+    static const int OCTAVES = 28;
+    static const int BUCKETS = SUB_BUCKETS * OCTAVES;
+private:
+    uint64_t buckets[BUCKETS];
+    uint64_t count;
+    int64_t sum;
+    int64_t max;
+
+    static int bucketIndex(int64_t us);
+    static int64_t bucketUpperBound(int index);
+public:
+    void record(int64_t us);
+    void reset();
+
+    uint64_t getCount() const {
+        return count;
+    }
+    int64_t getMax() const {
+        return max;
+    }
+    int64_t getSum() const {
+        return sum;
+    }
+    int64_t mean() const;
+    int64_t percentile(float p) const;
+
+    LatencyHistogram() {
+        reset();
+    }
+};
+
+// Latency from the kernel timestamp of an IR report to the moment the
+// resulting frame was written, split up by where the time was spent.
+class LatencyProbe {
+public:
+    // IR report timestamp until the report was dispatched by poll()
+    LatencyHistogram queueing;
+    // Dispatch until the output frame was complete
+    LatencyHistogram processing;
+    // Writing the output frame
+    LatencyHistogram output;
+    LatencyHistogram total;
+
+    void record(int64_t reportTime, int64_t dispatchTime, int64_t outputStartTime, int64_t writtenTime) {
+        queueing.record(dispatchTime - reportTime);
+        processing.record(outputStartTime - dispatchTime);
+        output.record(writtenTime - outputStartTime);
+        total.record(writtenTime - reportTime);
+    }
+
+    void reset() {
+        queueing.reset();
+        processing.reset();
+        output.reset();
+        total.reset();
+    }
+
+    // [name]:[count]:[mean]:[p50]:[p99]:[max] for total, queue, processing
+    // and output, all in microseconds
+    std::string toProtocolString() const;
+};
@@ -0,0 +1,154 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+
+#include "metrics.hpp"
+
+#include <charconv>
+#include <cstdio>
+
+void appendMetricLabel(std::string& labels, std::string_view name, std::string_view value) {
+    if (!labels.empty()) {
+        labels += ',';
+    }
+    labels += name;
+    labels += "=\"";
+    for (char c : value) {
+        switch (c) {
+            case '\\':
+                labels += "\\\\";
+                break;
+            case '"':
+                labels += "\\\"";
+                break;
+            case '\n':
+                labels += "\\n";
+                break;
+            default:
+                labels += c;
+        }
+    }
+    labels += '"';
+}
+
+void OpenMetricsWriter :: sampleName(std::string_view name, std::string_view suffix, std::string_view labels) {
+    out += PREFIX;
+    out += name;
+    out += suffix;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+}
+
+void OpenMetricsWriter :: family(std::string_view name, std::string_view type, std::string_view help, std::string_view unit) {
+    out += "# TYPE ";
+    out += PREFIX;
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+    if (!unit.empty()) {
+        out += "# UNIT ";
+        out += PREFIX;
+        out += name;
+        out += ' ';
+        out += unit;
+        out += '\n';
+    }
+    out += "# HELP ";
+    out += PREFIX;
+    out += name;
+    out += ' ';
+    out += help;
+    out += '\n';
+}
+
+void OpenMetricsWriter :: sample(std::string_view name, std::string_view suffix, std::string_view labels, uint64_t value) {
+    sampleName(name, suffix, labels);
+    char buffer[24];
+    const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr - buffer);
+    out += '\n';
+}
+
+void OpenMetricsWriter :: sample(std::string_view name, std::string_view suffix, std::string_view labels, double value) {
+    sampleName(name, suffix, labels);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.9g", value);
+    out += buffer;
+    out += '\n';
+}
+
+void OpenMetricsWriter :: summary(std::string_view name, std::string_view labels, const LatencyHistogram& histogram) {
+    static const char* QUANTILES[] = {"0.5", "0.9", "0.99"};
+    static const float QUANTILE_VALUES[] = {0.5f, 0.9f, 0.99f};
+
+    std::string quantileLabels;
+    for (int i = 0; i < 3; i++) {
+        quantileLabels = labels;
+        appendMetricLabel(quantileLabels, "quantile", QUANTILES[i]);
+        sample(name, "", quantileLabels, histogram.percentile(QUANTILE_VALUES[i]) / 1e6);
+    }
+    sample(name, "_sum", labels, histogram.getSum() / 1e6);
+    sample(name, "_count", labels, histogram.getCount());
+}
+
+void OpenMetricsWriter :: finish() {
+    out += "# EOF\n";
+}
+
+void DriverMetrics :: write(OpenMetricsWriter& writer) const {
+    writer.family("frames", "counter", "Frames run through the filter pipeline");
+    writer.sample("frames", "_total", "", framesProcessed);
+
+    writer.family("ir_reports", "counter", "IR reports received from the wiimote");
+    writer.sample("ir_reports", "_total", "", irReports);
+    writer.family("ir_reports_coalesced", "counter", "IR reports replaced by a newer one before a frame processed them");
+    writer.sample("ir_reports_coalesced", "_total", "", coalescedIrReports);
+
+    writer.family("valid_ir_spot_frames", "counter", "Frames by the number of valid IR spots the wiimote reported");
+    std::string labels;
+    for (int i = 0; i <= MAX_IR_SPOTS; i++) {
+        labels.clear();
+        appendMetricLabel(labels, "spots", std::to_string(i));
+        writer.sample("valid_ir_spot_frames", "_total", labels, validSpotFrames[i]);
+    }
+
+    writer.family("tick_overruns", "counter", "Frames that started more than one frame interval late");
+    writer.sample("tick_overruns", "_total", "", tickOverruns);
+
+    writer.family("wiimote_connects", "counter", "Wiimote connections, every one after the first is a reconnect");
+    writer.sample("wiimote_connects", "_total", "", wiimoteConnects);
+    writer.family("wiimote_disconnects", "counter", "Wiimote connections that were lost");
+    writer.sample("wiimote_disconnects", "_total", "", wiimoteDisconnects);
+
+    writer.family("output_events", "counter", "Input events written to the mouse output, including SYN_REPORTs");
+    writer.sample("output_events", "_total", "", uinputEvents);
+}
+
+DriverMetrics :: DriverMetrics() :
+    framesProcessed(0),
+    irReports(0),
+    coalescedIrReports(0),
+    validSpotFrames{0, 0, 0, 0, 0},
+    tickOverruns(0),
+    wiimoteConnects(0),
+    wiimoteDisconnects(0),
+    uinputEvents(0)
+{}
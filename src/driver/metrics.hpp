@@ -0,0 +1,75 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <stdint.h>
+
+#include "latency.hpp"
+
+// Appends metrics in the OpenMetrics text format to a string. Every
+// metric family is started with family() and followed by its samples.
+// Names are given without the common prefix.
+class OpenMetricsWriter {
+private:
+    std::string& out;
+
+    void sampleName(std::string_view name, std::string_view suffix, std::string_view labels);
+public:
+    static constexpr char PREFIX[] = "wiimote_mouse_";
+
+    // type is one of counter, gauge or summary. A unit must also be the
+    // last part of the name.
+    void family(std::string_view name, std::string_view type, std::string_view help, std::string_view unit = "");
+    // labels is empty or a list made with label()
+    void sample(std::string_view name, std::string_view suffix, std::string_view labels, uint64_t value);
+    void sample(std::string_view name, std::string_view suffix, std::string_view labels, double value);
+    // Quantiles, sum and count of a histogram of microseconds, in seconds
+    void summary(std::string_view name, std::string_view labels, const LatencyHistogram& histogram);
+    // Terminates the exposition, nothing can be written afterwards
+    void finish();
+
+    OpenMetricsWriter(std::string& out) : out(out) {}
+};
+
+// Appends name="value" to a label list, escaping the value
+void appendMetricLabel(std::string& labels, std::string_view name, std::string_view value);
+
+// Counters of the frame loop. Owned by the main thread, which also runs
+// the metrics command.
+struct DriverMetrics {
+    // Histogram of the valid IR spots per frame, 0 to 4
+    static const int MAX_IR_SPOTS = 4;
+
+    uint64_t framesProcessed;
+    uint64_t irReports;
+    // IR reports replaced by a newer one before a frame processed them
+    uint64_t coalescedIrReports;
+    uint64_t validSpotFrames[MAX_IR_SPOTS + 1];
+    // Frames that started late by more than a whole frame interval
+    uint64_t tickOverruns;
+    uint64_t wiimoteConnects;
+    uint64_t wiimoteDisconnects;
+    uint64_t uinputEvents;
+
+    void write(OpenMetricsWriter& writer) const;
+
+    DriverMetrics();
+};
@@ -0,0 +1,100 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <utility>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Immutable parameters shared between one writer (control code) and one
+// reader (frame processing), RCU style. The writer publishes a complete
+// new block with an atomic pointer swap. The reader picks up the current
+// block at the start of every frame without waiting and uses it until the
+// next frame. Blocks replaced by a publish are reused once the reader has
+// started a frame after the swap, so in steady state no memory is
+// allocated.
+template <typename T>
+class ParameterBlock {
+private:
+    std::atomic<T*> published;
+    // Incremented by the reader before it loads published. A block retired
+    // at generation g is no longer used once readerGeneration > g.
+    std::atomic<uint64_t> readerGeneration;
+
+    // Writer only
+    std::vector<std::pair<T*, uint64_t>> retired;
+    std::vector<T*> spare;
+
+    void reclaim() {
+        const uint64_t generation = readerGeneration.load();
+        for (size_t i = 0; i < retired.size();) {
+            if (retired[i].second < generation) {
+                spare.push_back(retired[i].first);
+                retired[i] = retired.back();
+                retired.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+public:
+    // Reader only. The block stays valid until the next call.
+    const T& acquire() {
+        readerGeneration.fetch_add(1);
+        return *published.load();
+    }
+
+    // Writer only. The block that was published last.
+    const T& latest() const {
+        return *published.load(std::memory_order_relaxed);
+    }
+
+    // Writer only
+    void publish(const T& value) {
+        reclaim();
+
+        T* block;
+        if (spare.empty()) {
+            block = new T(value);
+        } else {
+            block = spare.back();
+            spare.pop_back();
+            *block = value;
+        }
+
+        T* old = published.exchange(block);
+        retired.emplace_back(old, readerGeneration.load());
+    }
+
+    ParameterBlock(const T& initial = T()) : published(new T(initial)), readerGeneration(0) {}
+
+    ~ParameterBlock() {
+        delete published.load();
+        for (auto& entry : retired) {
+            delete entry.first;
+        }
+        for (T* block : spare) {
+            delete block;
+        }
+    }
+
+    ParameterBlock(const ParameterBlock& other) = delete;
+    ParameterBlock& operator=(const ParameterBlock& other) = delete;
+};
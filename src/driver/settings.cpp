@@ -16,51 +16,121 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 
 #include "settings.hpp"
 
+#include <unordered_map>
+#include <limits>
+#include <cctype>
+
 #include "stringtools.hpp"
+#include "virtualmouse.hpp"
+#include "controlsocket.hpp"
+#include "flightrecorder.hpp"
 
-const char* VALID_OPTIONS[] = {
-    "socket_address",
-    "calmatx",
-    "calmaty",
-    "screen_top_left",
-    "screen_bottom_right",
-    "button_a",
-    "button_b",
-    "button_plus",
-    "button_minus",
-    "button_home",
-    "button_one",
-    "button_two",
-    "button_up",
-    "button_down",
-    "button_left",
-    "button_right",
-    "button_a_offscreen",
-    "button_b_offscreen",
-    "button_plus_offscreen",
-    "button_minus_offscreen",
-    "button_home_offscreen",
-    "button_one_offscreen",
-    "button_two_offscreen",
-    "button_up_offscreen",
-    "button_down_offscreen",
-    "button_left_offscreen",
-    "button_right_offscreen",
-    "default_ir_distance",
-    "smoothing_clicked_released_delay",
-    "towed_circle_radius",
-    nullptr
-};
+static bool isSlowConsumerPolicyName(const std::string& value) {
+    SlowConsumerPolicy policy;
+    return parseSlowConsumerPolicy(value, policy);
+}
+
+static bool isWiimoteButtonSet(const std::string& value) {
+    WiimoteButtonSet buttons;
+    return parseWiimoteButtonSet(value, buttons);
+}
+
+static constexpr int64_t UNBOUNDED_MIN = std::numeric_limits<int64_t>::min();
+static constexpr int64_t UNBOUNDED_MAX = std::numeric_limits<int64_t>::max();
+
+static constexpr SettingSchema textSetting(
+    const char* name, const char* defaultValue, bool (*isValidText)(const std::string&) = nullptr
+) {
+    return {name, SettingType::Text, 0, 0, 0, {}, defaultValue, isValidText, false};
+}
+
+static constexpr SettingSchema integerSetting(
+    const char* name, int64_t defaultValue, int64_t minValue, int64_t maxValue, bool perProfile = false
+) {
+    return {name, SettingType::Integer, minValue, maxValue, defaultValue, {}, "", nullptr, perProfile};
+}
+
+static constexpr SettingSchema vectorSetting(
+    const char* name, SettingFraction x, SettingFraction y, SettingFraction z, 
+    int64_t minValue = UNBOUNDED_MIN, int64_t maxValue = UNBOUNDED_MAX
+) {
+    return {name, SettingType::Vector, minValue, maxValue, 0, {x, y, z}, "", nullptr, true};
+}
 
-const char* VECTOR_OPTIONS[] = {
-    "calmatx",
-    "calmaty",
-    "screen_top_left",
-    "screen_bottom_right",
-    "smoothing_clicked_released_delay",
-    nullptr
+static constexpr SettingSchema keySetting(const char* name, const char* defaultValue = "") {
+    return {name, SettingType::Key, 0, 0, -1, {}, defaultValue, nullptr, true};
+}
+
+constexpr SettingSchema SETTINGS_SCHEMA[(int) SettingKey::COUNT] = {
+    textSetting("socket_address", DEFAULT_SOCKET_ADDR),
+    textSetting("slow_consumer_policy", "drop_oldest", isSlowConsumerPolicyName),
+    integerSetting("client_queue_limit", DEFAULT_CLIENT_QUEUE_LIMIT, MIN_CLIENT_QUEUE_LIMIT, UNBOUNDED_MAX),
+    integerSetting("telemetry_change_threshold", 0, 0, INT32_MAX),
+    // Milliseconds
+    integerSetting(
+        "telemetry_keyframe_interval", 
+        DEFAULT_TELEMETRY_KEYFRAME_INTERVAL_MICROS / 1000, 0, INT32_MAX
+    ),
+    vectorSetting("calmatx", {-10000, 1024}, {0, 1}, {10000, 1}),
+    vectorSetting("calmaty", {0, 1}, {10000, 1024}, {0, 1}),
+    vectorSetting("screen_top_left", {0, 1}, {0, 1}, {0, 1}, 0, 10000),
+    vectorSetting("screen_bottom_right", {10000, 1}, {10000, 1}, {0, 1}, 0, 10000),
+    keySetting("button_a", "BTN_LEFT"),
+    keySetting("button_b", "BTN_RIGHT"),
+    keySetting("button_plus"),
+    keySetting("button_minus"),
+    keySetting("button_home"),
+    keySetting("button_one"),
+    keySetting("button_two"),
+    keySetting("button_up"),
+    keySetting("button_down"),
+    keySetting("button_left"),
+    keySetting("button_right"),
+    keySetting("button_a_offscreen"),
+    keySetting("button_b_offscreen"),
+    keySetting("button_plus_offscreen"),
+    keySetting("button_minus_offscreen"),
+    keySetting("button_home_offscreen"),
+    keySetting("button_one_offscreen"),
+    keySetting("button_two_offscreen"),
+    keySetting("button_up_offscreen"),
+    keySetting("button_down_offscreen"),
+    keySetting("button_left_offscreen"),
+    keySetting("button_right_offscreen"),
+    // Hundredths
+    integerSetting("default_ir_distance", 10000, 0, INT32_MAX, true),
+    // log10 of the clicked and released smoothing factors, click freeze 
+    // time in seconds
+    vectorSetting("smoothing_clicked_released_delay", {-1, 1}, {-5, 1}, {1, 10}),
+    // Ten-thousandths
+    integerSetting("towed_circle_radius", 50, 0, 10000, true),
+    // Wiimote buttons that switch to the next profile when held together,
+    // for example "plus,minus". Empty disables the chord.
+    textSetting("profile_switch_chord", "", isWiimoteButtonSet),
+    // Frames kept by the flight recorder, only read at startup
+    integerSetting("flight_recorder_seconds", DEFAULT_FLIGHT_RECORDER_SECONDS, 1, 600),
+    // Where dumps of the flight recorder are written
+    textSetting("flight_recorder_directory", "."),
+    // Cursor movement between two frames that triggers a dump, in absolute
+    // mouse coordinates. 0 disables the trigger.
+    integerSetting("flight_recorder_jump_threshold", 3000, 0, 20000)
 };
 
+static constexpr bool schemaMatchesButtons() {
+    for (int i = 0; i < 2 * (int) WiimoteButton::COUNT; i++) {
+        if (SETTINGS_SCHEMA[(int) SettingKey::ButtonA + i].type != SettingType::Key) {
+            return false;
+        }
+    }
+    return SETTINGS_SCHEMA[(int) SettingKey::ButtonRightOffscreen + 1].type != SettingType::Key;
+}
+
+static_assert(
+    (int) SettingKey::ButtonRightOffscreen - (int) SettingKey::ButtonA + 1 == 2 * (int) WiimoteButton::COUNT,
+    "Every wiimote button needs an on and offscreen setting"
+);
+static_assert(schemaMatchesButtons(), "Button settings out of order");
+
 std::shared_ptr<Vector3> parseVector3(const std::string& str) {
     std::istringstream iss(str);
     std::vector<Scalar> values;
@@ -93,10 +163,140 @@ std::string vector3ToString(const Vector3& vec) {
     return oss.str();
 }
 
-bool isVectorOption(const std::string& key) {
-    return isStringInCstrList(key, VECTOR_OPTIONS);
+bool findSettingKey(const std::string& name, SettingKey& key) {
+    static std::unordered_map<std::string, SettingKey> QUICK_LOOKUP;
+    if (QUICK_LOOKUP.empty()) {
+        for (int i = 0; i < (int) SettingKey::COUNT; i++) {
+            QUICK_LOOKUP[SETTINGS_SCHEMA[i].name] = (SettingKey) i;
+        }
+    }
+
+    auto it = QUICK_LOOKUP.find(name);
+    if (it == QUICK_LOOKUP.end()) {
+        return false;
+    }
+    key = it->second;
+    return true;
 }
 
-bool isValidOption(const std::string& key) {
-    return isStringInCstrList(key, VALID_OPTIONS);
+bool Settings :: parse(SettingKey key, const std::string& value, std::string& error) {
+    const SettingSchema& schema = SETTINGS_SCHEMA[(int) key];
+    switch (schema.type) {
+        case SettingType::Text: {
+            const std::string text = trim(value);
+            if (schema.isValidText && !schema.isValidText(text)) {
+                error = "invalid value";
+                return false;
+            }
+            texts[(int) key] = text;
+            return true;
+        }
+        case SettingType::Integer: {
+            int64_t integer;
+            try {
+                integer = parseLongLong(value);
+            }
+            catch (const std::exception& e) {
+                error = "not an integer";
+                return false;
+            }
+            if ((integer < schema.minValue) || (integer > schema.maxValue)) {
+                error = "out of range [" + std::to_string(schema.minValue) + ", " + std::to_string(schema.maxValue) + "]";
+                return false;
+            }
+            integers[(int) key] = integer;
+            return true;
+        }
+        case SettingType::Vector: {
+            auto vec = parseVector3(value);
+            if (!vec) {
+                error = "not a vector";
+                return false;
+            }
+            for (int i = 0; i < 3; i++) {
+                const float component = vec->values[i].toFloat();
+                if ((component < (float) schema.minValue) || (component > (float) schema.maxValue)) {
+                    error = "out of range [" + std::to_string(schema.minValue) + ", " + std::to_string(schema.maxValue) + "]";
+                    return false;
+                }
+            }
+            vectors[(int) key] = *vec;
+            return true;
+        }
+        case SettingType::Key: {
+            const std::string name = trim(value);
+            int64_t index = -1;
+            if (!name.empty()) {
+                const SupportedButton* button = findButtonByName(name);
+                if (!button) {
+                    error = "unknown key " + name;
+                    return false;
+                }
+                index = button - SUPPORTED_BUTTONS.data();
+            }
+            texts[(int) key] = name;
+            integers[(int) key] = index;
+            return true;
+        }
+    }
+    error = "invalid type";
+    return false;
+}
+
+std::string Settings :: format(SettingKey key) const {
+    switch (SETTINGS_SCHEMA[(int) key].type) {
+        case SettingType::Integer:
+            return std::to_string(integers[(int) key]);
+        case SettingType::Vector:
+            return vector3ToString(vectors[(int) key]);
+        default:
+            return texts[(int) key];
+    }
+}
+
+bool Settings :: equals(const Settings& other, SettingKey key) const {
+    switch (SETTINGS_SCHEMA[(int) key].type) {
+        case SettingType::Integer:
+            return integers[(int) key] == other.integers[(int) key];
+        case SettingType::Vector:
+            return vectors[(int) key] == other.vectors[(int) key];
+        default:
+            return texts[(int) key] == other.texts[(int) key];
+    }
+}
+
+void Settings :: copy(const Settings& other, SettingKey key) {
+    integers[(int) key] = other.integers[(int) key];
+    vectors[(int) key] = other.vectors[(int) key];
+    texts[(int) key] = other.texts[(int) key];
+}
+
+bool isValidProfileName(const std::string& name) {
+    if (name.empty() || (name == DEFAULT_PROFILE_NAME)) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum((unsigned char) c) && (c != '_') && (c != '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Settings :: Settings() {
+    for (int i = 0; i < (int) SettingKey::COUNT; i++) {
+        const SettingSchema& schema = SETTINGS_SCHEMA[i];
+        integers[i] = schema.defaultInteger;
+        texts[i] = schema.defaultText;
+        if (schema.type == SettingType::Vector) {
+            vectors[i] = Vector3(
+                Scalar(schema.defaultVector[0].value, schema.defaultVector[0].divisor),
+                Scalar(schema.defaultVector[1].value, schema.defaultVector[1].divisor),
+                Scalar(schema.defaultVector[2].value, schema.defaultVector[2].divisor)
+            );
+        } else if (schema.type == SettingType::Key) {
+            std::string error;
+            parse((SettingKey) i, schema.defaultText, error);
+        }
+    }
 }
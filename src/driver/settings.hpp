@@ -20,47 +20,317 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <memory>
-#include <unordered_map>
+#include <bitset>
+
+#include <stdint.h>
 
 #include "intlinalg.hpp"
-#include "stringtools.hpp"
+#include "device.hpp"
 
 static const std::string DEFAULT_CONFIG_PATH = "./wiimote-mouse.conf";
-extern const char* VECTOR_OPTIONS[];
+// Name of the profile made of the options outside of any profile section
+static const std::string DEFAULT_PROFILE_NAME = "default";
 
 std::shared_ptr<Vector3> parseVector3(const std::string& str);
 std::string vector3ToString(const Vector3& vec);
 
-bool isVectorOption(const std::string& key);
-bool isValidOption(const std::string& key);
+// All options of the config file, in the order of SETTINGS_SCHEMA
+enum class SettingKey {
+    SocketAddress,
+    SlowConsumerPolicy,
+    ClientQueueLimit,
+    TelemetryChangeThreshold,
+    TelemetryKeyframeInterval,
+    CalmatX,
+    CalmatY,
+    ScreenTopLeft,
+    ScreenBottomRight,
+    // Indexed by WiimoteButton, see buttonSettingKey
+    ButtonA, ButtonB, ButtonPlus, ButtonMinus, ButtonHome, ButtonOne, 
+    ButtonTwo, ButtonUp, ButtonDown, ButtonLeft, ButtonRight,
+    ButtonAOffscreen, ButtonBOffscreen, ButtonPlusOffscreen, 
+    ButtonMinusOffscreen, ButtonHomeOffscreen, ButtonOneOffscreen, 
+    ButtonTwoOffscreen, ButtonUpOffscreen, ButtonDownOffscreen, 
+    ButtonLeftOffscreen, ButtonRightOffscreen,
+    DefaultIrDistance,
+    SmoothingClickedReleasedDelay,
+    TowedCircleRadius,
+    ProfileSwitchChord,
+    FlightRecorderSeconds,
+    FlightRecorderDirectory,
+    FlightRecorderJumpThreshold,
+    COUNT
+};
+
+typedef std::bitset<(size_t) SettingKey::COUNT> SettingKeySet;
+
+// Key of the binding of a wiimote button while pointing at the screen
+// (irVisible) or not
+inline SettingKey buttonSettingKey(WiimoteButton button, bool irVisible) {
+    int key = (int) SettingKey::ButtonA + (int) button;
+    if (!irVisible) {
+        key += (int) WiimoteButton::COUNT;
+    }
+    return (SettingKey) key;
+}
+
+enum class SettingType {
+    Text,
+    Integer,
+    // Three fractions in the format x/d,y/d,z/d
+    Vector,
+    // Name of a key from SUPPORTED_BUTTONS or empty, stored as its index
+    // into SUPPORTED_BUTTONS (-1 if empty)
+    Key
+};
+
+struct SettingFraction {
+    int64_t value;
+    int64_t divisor;
+};
+
+struct SettingSchema {
+    const char* name;
+    SettingType type;
+    // Inclusive range of integer settings and of every vector component
+    int64_t minValue;
+    int64_t maxValue;
+
+    int64_t defaultInteger;
+    SettingFraction defaultVector[3];
+    // Default of text and key settings
+    const char* defaultText;
+    // Text settings only, nullptr accepts every value
+    bool (*isValidText)(const std::string& value);
+    // Can be set per profile with profile.<name>.<option>=<value>
+    bool perProfile;
+};
+
+extern const SettingSchema SETTINGS_SCHEMA[(int) SettingKey::COUNT];
+
+inline const char* settingName(SettingKey key) {
+    return SETTINGS_SCHEMA[(int) key].name;
+}
+
+bool findSettingKey(const std::string& name, SettingKey& key);
+
+// Typed values of all settings. Every value is parsed and checked once
+// when it is set from text, reading a value is a plain array access.
+class Settings {
+private:
+    int64_t integers[(int) SettingKey::COUNT];
+    Vector3 vectors[(int) SettingKey::COUNT];
+    std::string texts[(int) SettingKey::COUNT];
+public:
+    // Integer and key settings
+    int64_t integer(SettingKey key) const {
+        return integers[(int) key];
+    }
+
+    const Vector3& vector(SettingKey key) const {
+        return vectors[(int) key];
+    }
+
+    // Text and key settings
+    const std::string& text(SettingKey key) const {
+        return texts[(int) key];
+    }
+
+    // The typed setters do not check the schema range, the caller does
+    void setInteger(SettingKey key, int64_t value) {
+        integers[(int) key] = value;
+    }
+
+    void setVector(SettingKey key, const Vector3& value) {
+        vectors[(int) key] = value;
+    }
+
+    void setText(SettingKey key, const std::string& value) {
+        texts[(int) key] = value;
+    }
+
+    // Parses and checks a value in the config file format. On failure the
+    // setting keeps its value and error describes the problem.
+    bool parse(SettingKey key, const std::string& value, std::string& error);
+    std::string format(SettingKey key) const;
+    bool equals(const Settings& other, SettingKey key) const;
+    void copy(const Settings& other, SettingKey key);
+
+    // All settings start with the defaults of the schema
+    Settings();
+};
+
+// Options of a named profile. Options the profile does not override are
+// taken from the default profile when the file is read.
+struct SettingsProfile {
+    std::string name;
+    Settings settings;
+    SettingKeySet overridden;
+};
+
+bool isValidProfileName(const std::string& name);
 
 class Config {
 private:
     std::string filePath;
-public:
-    std::unordered_map<std::string, std::string> stringOptions;
-    std::unordered_map<std::string, Vector3> vectorOptions;
+    bool changed;
+    uint64_t writes;
+    uint64_t failedWrites;
+    bool inheritedChanged;
 
-    Config(const std::string& filePath) : filePath(filePath) {}
+    SettingsProfile* findProfile(const std::string& name) {
+        for (SettingsProfile& profile : profiles) {
+            if (profile.name == name) {
+                return &profile;
+            }
+        }
+        return nullptr;
+    }
 
-    void provideDefault(std::string key, const std::string& value) {
-        key = asciiLower(key);
-        if (isVectorOption(key)) {
-            auto vec = parseVector3(value);
-            if (!vec) {
-                throw std::runtime_error("Failed to parse vector option: " + key);
+    // Settings that changes of key go to, marks the key as overridden if
+    // that is a profile
+    Settings& settingsToChange(SettingKey key) {
+        if (SETTINGS_SCHEMA[(int) key].perProfile) {
+            SettingsProfile* profile = findProfile(activeProfile);
+            if (profile) {
+                profile->overridden.set((size_t) key);
+                return profile->settings;
             }
-            if (vectorOptions.find(key) == vectorOptions.end()) {
-                vectorOptions[key] = *vec;
+        }
+        return settings;
+    }
+
+    // Passes a change of the default profile on to the profiles that do
+    // not override the option
+    void inheritChange(SettingKey key, const Settings& changedSettings) {
+        if ((&changedSettings != &settings) || !SETTINGS_SCHEMA[(int) key].perProfile) {
+            return;
+        }
+        for (SettingsProfile& profile : profiles) {
+            if (!profile.overridden.test((size_t) key)) {
+                profile.settings.copy(settings, key);
+                inheritedChanged = true;
             }
-        } else {
-            if (stringOptions.find(key) == stringOptions.end()) {
-                stringOptions[key] = value;
+        }
+    }
+
+    bool parseLine(const std::string& name, const std::string& value, std::string& error) {
+        SettingKey key;
+        if (name.compare(0, 8, "profile.") != 0) {
+            if (!findSettingKey(name, key)) {
+                error = "unknown option";
+                return false;
             }
+            return settings.parse(key, value, error);
+        }
+
+        const size_t dot = name.find('.', 8);
+        const std::string profileName = name.substr(8, dot == std::string::npos ? std::string::npos : dot - 8);
+        if ((dot == std::string::npos) || !isValidProfileName(profileName)) {
+            error = "invalid profile name";
+            return false;
+        }
+        if (!findSettingKey(name.substr(dot + 1), key) || !SETTINGS_SCHEMA[(int) key].perProfile) {
+            error = "unknown profile option";
+            return false;
+        }
+
+        SettingsProfile* profile = findProfile(profileName);
+        if (!profile) {
+            profiles.push_back({profileName, Settings(), SettingKeySet()});
+            profile = &profiles.back();
+        }
+        if (!profile->settings.parse(key, value, error)) {
+            return false;
         }
+        profile->overridden.set((size_t) key);
+        return true;
+    }
+
+    // Fills in all options the profiles do not override
+    void inheritProfileSettings() {
+        for (SettingsProfile& profile : profiles) {
+            for (int i = 0; i < (int) SettingKey::COUNT; i++) {
+                if (!profile.overridden.test(i)) {
+                    profile.settings.copy(settings, (SettingKey) i);
+                }
+            }
+        }
+    }
+public:
+    // The default profile
+    Settings settings;
+    std::vector<SettingsProfile> profiles;
+    // Only known at runtime, never written to the file
+    std::string activeProfile;
+
+    Config(const std::string& filePath) : 
+        filePath(filePath), changed(false), writes(0), failedWrites(0), inheritedChanged(false),
+        activeProfile(DEFAULT_PROFILE_NAME) {}
+
+    // Writes of the config file since the driver started
+    uint64_t getWriteCount() const {
+        return writes;
+    }
+    uint64_t getFailedWriteCount() const {
+        return failedWrites;
+    }
+
+    // Settings of the active profile
+    const Settings& activeSettings() {
+        SettingsProfile* profile = findProfile(activeProfile);
+        return profile ? profile->settings : settings;
+    }
+
+    // Per profile options are changed in the active profile, all others 
+    // in the default profile
+    void setInteger(SettingKey key, int64_t value) {
+        Settings& target = settingsToChange(key);
+        target.setInteger(key, value);
+        inheritChange(key, target);
+    }
+
+    void setVector(SettingKey key, const Vector3& value) {
+        Settings& target = settingsToChange(key);
+        target.setVector(key, value);
+        inheritChange(key, target);
+    }
+
+    bool parseSetting(SettingKey key, const std::string& value, std::string& error) {
+        Settings& target = settingsToChange(key);
+        if (!target.parse(key, value, error)) {
+            return false;
+        }
+        inheritChange(key, target);
+        return true;
+    }
+
+    // True once after a change of the default profile reached profiles
+    // that inherit it
+    bool takeInheritedChanges() {
+        const bool result = inheritedChanged;
+        inheritedChanged = false;
+        return result;
+    }
+
+    // Defers writing the file to the next writeIfChanged, so that many
+    // changes in a row are written once
+    void markChanged() {
+        changed = true;
+    }
+
+    bool writeIfChanged() {
+        if (!changed) {
+            return true;
+        }
+        changed = false;
+        return writeConfigFile();
     }
 
+    // Reads all options of the file. All invalid lines are reported
+    // together, their options keep the previous value.
     bool parseConfigFile() {
         std::ifstream configFile(filePath);
         if (!configFile.is_open()) {
@@ -68,49 +338,108 @@ public:
             return false;
         }
 
-        stringOptions.clear();
-        vectorOptions.clear();
+        // Profiles are built from scratch, their lines may come before the
+        // options they inherit
+        for (SettingsProfile& profile : profiles) {
+            profile.overridden.reset();
+        }
 
+        std::vector<std::string> errors;
         std::string line;
+        int lineNumber = 0;
         while (std::getline(configFile, line)) {
+            lineNumber++;
+            if (line.empty() || (line[0] == '#')) {
+                continue;
+            }
             line += "\n"; // Add back the newline so that the value-getline can engage with it
             
             std::istringstream iss(line);
-            std::string key, value;
-            if (std::getline(iss, key, '=') && std::getline(iss, value)) {
-                if (!isValidOption(key)) {
-                    std::cerr << "Ignoring invalid option: " << key << std::endl;
-                    continue;
-                }
-                if (isVectorOption(key)) {
-                    auto vec = parseVector3(value);
-                    if (!vec) {
-                        std::cerr << "Failed to parse vector option: " << key << std::endl;
-                        return false;
-                    }
-                    vectorOptions[key] = *vec;
-                } else {
-                    stringOptions[key] = value;
+            std::string name, value, error;
+            if (std::getline(iss, name, '=') && std::getline(iss, value)) {
+                if (!parseLine(name, value, error)) {
+                    errors.push_back("line " + std::to_string(lineNumber) + ": " + name + ": " + error);
                 }
             }
         }
-
         configFile.close();
+
+        for (size_t i = 0; i < profiles.size();) {
+            if (profiles[i].overridden.none()) {
+                profiles.erase(profiles.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        inheritProfileSettings();
+
+        if (!errors.empty()) {
+            std::cerr << "Invalid options in config file " << filePath << ":" << std::endl;
+            for (const std::string& error : errors) {
+                std::cerr << "  " << error << std::endl;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // Parses the file again and takes over all options whose value differs
+    // from the current one, the keys of the default profile are returned in
+    // changedKeys. profilesChanged tells if any named profile was added,
+    // removed or changed. Options missing from the file keep their current
+    // value. Nothing is taken over if the file has errors.
+    bool reloadConfigFile(SettingKeySet& changedKeys, bool& profilesChanged) {
+        Config fileConfig(filePath);
+        fileConfig.settings = settings;
+        fileConfig.profiles = profiles;
+        if (!fileConfig.parseConfigFile()) {
+            return false;
+        }
+
+        changedKeys.reset();
+        for (int i = 0; i < (int) SettingKey::COUNT; i++) {
+            if (!settings.equals(fileConfig.settings, (SettingKey) i)) {
+                changedKeys.set(i);
+            }
+        }
+
+        profilesChanged = profiles.size() != fileConfig.profiles.size();
+        for (size_t p = 0; (p < profiles.size()) && !profilesChanged; p++) {
+            const SettingsProfile& current = profiles[p];
+            const SettingsProfile& loaded = fileConfig.profiles[p];
+            profilesChanged = (current.name != loaded.name) || (current.overridden != loaded.overridden);
+            for (int i = 0; (i < (int) SettingKey::COUNT) && !profilesChanged; i++) {
+                profilesChanged = 
+                    SETTINGS_SCHEMA[i].perProfile && 
+                    !current.settings.equals(loaded.settings, (SettingKey) i);
+            }
+        }
+
+        settings = fileConfig.settings;
+        profiles = fileConfig.profiles;
         return true;
     }
 
     bool writeConfigFile() {
+        writes++;
         std::ofstream configFile(filePath);
         if (!configFile.is_open()) {
             std::cerr << "Failed to open config file: " << filePath << std::endl;
+            failedWrites++;
             return false;
         }
 
-        for (auto& pair : stringOptions) {
-            configFile << asciiLower(pair.first) << "=" << pair.second << std::endl;
+        for (int i = 0; i < (int) SettingKey::COUNT; i++) {
+            configFile << settingName((SettingKey) i) << "=" << settings.format((SettingKey) i) << std::endl;
         }
-        for (auto& pair : vectorOptions) {
-            configFile << asciiLower(pair.first) << "=" << vector3ToString(pair.second) << std::endl;
+        for (const SettingsProfile& profile : profiles) {
+            for (int i = 0; i < (int) SettingKey::COUNT; i++) {
+                if (profile.overridden.test(i)) {
+                    configFile 
+                        << "profile." << profile.name << "." << settingName((SettingKey) i) 
+                        << "=" << profile.settings.format((SettingKey) i) << std::endl;
+                }
+            }
         }
 
         configFile.close();
@@ -17,6 +17,8 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include "stringtools.hpp"
 
 #include <algorithm>
+#include <charconv>
+#include <stdexcept>
 
 std::vector<std::string> split(const std::string& str, char delim) {
     std::vector<std::string> result;
@@ -45,6 +47,38 @@ std::string trim(const std::string& str) {
     return str.substr(start, end - start + 1);
 }
 
+std::string_view trimView(std::string_view str) {
+    // NUL counts as whitespace, old clients padded their requests with it
+    size_t start = 0;
+    size_t end = str.size();
+    while ((start < end) && (isWhitespace(str[start]) || (str[start] == 0))) {
+        start++;
+    }
+    while ((start < end) && (isWhitespace(str[end - 1]) || (str[end - 1] == 0))) {
+        end--;
+    }
+    return str.substr(start, end - start);
+}
+
+long long parseLongLong(std::string_view str) {
+    str = trimView(str);
+    const char* first = str.data();
+    const char* last = str.data() + str.size();
+    if ((first != last) && (*first == '+')) {
+        first++;
+    }
+
+    long long result = 0;
+    const std::from_chars_result parsed = std::from_chars(first, last, result);
+    if (parsed.ec == std::errc::result_out_of_range) {
+        throw std::out_of_range("parseLongLong");
+    }
+    if ((parsed.ec != std::errc()) || (parsed.ptr == first)) {
+        throw std::invalid_argument("parseLongLong");
+    }
+    return result;
+}
+
 std::string replaceAll(const std::string& str, const std::string& from, const std::string& to) {
     std::string result = str;
     size_t pos = 0;
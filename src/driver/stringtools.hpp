@@ -17,6 +17,7 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 static constexpr bool isWhitespace(char c) {
@@ -25,6 +26,10 @@ static constexpr bool isWhitespace(char c) {
 
 extern std::vector<std::string> split(const std::string& str, char delim);
 extern std::string trim(const std::string& str);
+extern std::string_view trimView(std::string_view str);
+// Like std::stoll, but without a copy: throws std::invalid_argument or
+// std::out_of_range
+extern long long parseLongLong(std::string_view str);
 extern std::string replaceAll(const std::string& str, const std::string& from, const std::string& to);
 extern bool isStringInCstrList(const std::string& key, const char* list[]);
 extern std::string asciiLower(const std::string& str);
@@ -0,0 +1,165 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#include "telemetry.hpp"
+
+#include <cstdio>
+
+static void putU8(std::string& out, uint8_t v) {
+    out.push_back((char) v);
+}
+
+static void putU16(std::string& out, uint16_t v) {
+    putU8(out, v & 0xFF);
+    putU8(out, (v >> 8) & 0xFF);
+}
+
+static void putU32(std::string& out, uint32_t v) {
+    putU16(out, v & 0xFFFF);
+    putU16(out, (v >> 16) & 0xFFFF);
+}
+
+static void putU64(std::string& out, uint64_t v) {
+    putU32(out, v & 0xFFFFFFFFUL);
+    putU32(out, (v >> 32) & 0xFFFFFFFFUL);
+}
+
+void TelemetryFrame :: formatTopics(TelemetryTopicMessages& out) const {
+    char buffer[1024];
+
+    std::string& ir = out[(int) TelemetryTopic::Ir];
+    ir.clear();
+    for (int i = 0; i < 4; i++) {
+        snprintf(
+            buffer,
+            1024,
+            "ir:%i:%i:%i:%i\n",
+            i,
+            (int) irValid[i],
+            (int) irPoints[i][0],
+            (int) irPoints[i][1]
+        );
+        ir += buffer;
+    }
+
+    if (lrValid) {
+        snprintf(buffer, 1024, "lr:%i:%i:%i:%i\n", lr[0], lr[1], lr[2], lr[3]);
+        out[(int) TelemetryTopic::Lr] = buffer;
+        snprintf(buffer, 1024, "flr:%i:%i:%i:%i\n", flr[0], flr[1], flr[2], flr[3]);
+        out[(int) TelemetryTopic::Flr] = buffer;
+    } else {
+        out[(int) TelemetryTopic::Lr] = "lr:invalid\n";
+        out[(int) TelemetryTopic::Flr] = "flr:invalid\n";
+    }
+
+    out[(int) TelemetryTopic::Buttons] = "b:" + buttons.toMsgState() + "\n";
+
+    snprintf(buffer, 1024, "accel:%i:%i:%i\n", accel[0], accel[1], accel[2]);
+    out[(int) TelemetryTopic::Accel] = buffer;
+
+    if (cursorValid) {
+        snprintf(buffer, 1024, "cursor:%i:%i\n", cursor[0], cursor[1]);
+        out[(int) TelemetryTopic::Cursor] = buffer;
+    } else {
+        out[(int) TelemetryTopic::Cursor] = "cursor:invalid\n";
+    }
+
+    snprintf(
+        buffer, 
+        1024, 
+        "stats:%u:%lli:%i\n", 
+        sequence, 
+        (long long) timestamp, 
+        processingMicros
+    );
+    out[(int) TelemetryTopic::Stats] = buffer;
+}
+
+static void setValues(TopicValues& out, uint32_t flags, const int32_t* values, int count) {
+    out.flags = flags;
+    out.count = count;
+    for (int i = 0; i < count; i++) {
+        out.values[i] = values[i];
+    }
+}
+
+void TelemetryFrame :: topicValues(TelemetryTopicValues& out) const {
+    // Coordinates of invalid points are undefined and must not count as a
+    // change
+    TopicValues& ir = out[(int) TelemetryTopic::Ir];
+    ir.flags = 0;
+    ir.count = 8;
+    for (int i = 0; i < 4; i++) {
+        ir.flags |= irValid[i] ? (1 << i) : 0;
+        ir.values[2 * i] = irValid[i] ? irPoints[i][0] : 0;
+        ir.values[2 * i + 1] = irValid[i] ? irPoints[i][1] : 0;
+    }
+
+    setValues(out[(int) TelemetryTopic::Lr], lrValid, lr, lrValid ? 4 : 0);
+    setValues(out[(int) TelemetryTopic::Flr], lrValid, flr, lrValid ? 4 : 0);
+
+    setValues(out[(int) TelemetryTopic::Buttons], (uint32_t) buttons.pressedButtons.to_ulong(), nullptr, 0);
+    setValues(out[(int) TelemetryTopic::Accel], 0, accel, 3);
+    setValues(out[(int) TelemetryTopic::Cursor], cursorValid, cursor, cursorValid ? 2 : 0);
+    setValues(out[(int) TelemetryTopic::Stats], 0, nullptr, 0);
+}
+
+void TelemetryFrame :: encodeBinary(std::string& out) const {
+    // A leading zero byte never starts an ASCII reply, so clients can tell
+    // records and replies apart
+    putU8(out, 0);
+    putU8(out, TELEMETRY_RECORD_VERSION);
+    putU16(out, TELEMETRY_RECORD_SIZE);
+    putU32(out, sequence);
+    putU64(out, (uint64_t) timestamp);
+
+    uint32_t flags = 0;
+    for (int i = 0; i < 4; i++) {
+        flags |= irValid[i] ? (1 << i) : 0;
+    }
+    flags |= lrValid ? (1 << 4) : 0;
+    flags |= cursorValid ? (1 << 5) : 0;
+    putU32(out, flags);
+
+    for (int i = 0; i < 4; i++) {
+        putU32(out, (uint32_t) irPoints[i][0]);
+        putU32(out, (uint32_t) irPoints[i][1]);
+    }
+    for (int i = 0; i < 4; i++) {
+        putU32(out, (uint32_t) lr[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        putU32(out, (uint32_t) flr[i]);
+    }
+    putU32(out, (uint32_t) cursor[0]);
+    putU32(out, (uint32_t) cursor[1]);
+    putU32(out, (uint32_t) buttons.pressedButtons.to_ulong());
+}
+
+TelemetryFrame :: TelemetryFrame() {
+    sequence = 0;
+    timestamp = 0;
+    for (int i = 0; i < 4; i++) {
+        irValid[i] = false;
+        irPoints[i][0] = irPoints[i][1] = 0;
+        lr[i] = flr[i] = 0;
+    }
+    lrValid = false;
+    cursorValid = false;
+    cursor[0] = cursor[1] = 0;
+    accel[0] = accel[1] = accel[2] = 0;
+    processingMicros = 0;
+}
@@ -0,0 +1,59 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <string>
+
+#include <stdint.h>
+
+#include "device.hpp"
+#include "controlsocket.hpp"
+
+// Size of a binary telemetry record in bytes, see protocol.md
+static const int TELEMETRY_RECORD_SIZE = 96;
+static const uint8_t TELEMETRY_RECORD_VERSION = 1;
+
+// Everything the driver reports to telemetry clients about one frame
+struct TelemetryFrame {
+    uint32_t sequence;
+    int64_t timestamp;
+
+    bool irValid[4];
+    int32_t irPoints[4][2];
+
+    bool lrValid;
+    int32_t lr[4];
+    int32_t flr[4];
+
+    bool cursorValid;
+    int32_t cursor[2];
+
+    WiimoteButtonStates buttons;
+
+    int32_t accel[3];
+    // Time spent in the filter pipeline for this frame
+    int32_t processingMicros;
+
+    // Replaces the ASCII messages of every topic
+    void formatTopics(TelemetryTopicMessages& out) const;
+    // Replaces the values the change filter compares for every topic
+    void topicValues(TelemetryTopicValues& out) const;
+    // Appends one TELEMETRY_RECORD_SIZE bytes little-endian record
+    void encodeBinary(std::string& out) const;
+
+    TelemetryFrame();
+};
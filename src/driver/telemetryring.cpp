@@ -0,0 +1,107 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#include "telemetryring.hpp"
+
+#include <new>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static const size_t CACHE_LINE_SIZE = 64;
+
+static size_t roundUp(size_t value, size_t multiple) {
+    return ((value + multiple - 1) / multiple) * multiple;
+}
+
+void TelemetryRing :: publish(const void* record) {
+    const uint64_t index = header->published.load(std::memory_order_relaxed);
+    TelemetryRingSlot* target = slot(index);
+
+    const uint32_t sequence = target->sequence.load(std::memory_order_relaxed);
+    target->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(target->record(), record, recordSize);
+
+    target->sequence.store(sequence + 2, std::memory_order_release);
+    header->published.store(index + 1, std::memory_order_release);
+}
+
+int TelemetryRing :: openReadOnly() const {
+    // The descriptor is opened read-only, but only the write seal keeps a
+    // receiver from reopening it writable through procfs
+    const std::string path = "/proc/self/fd/" + std::to_string(fd);
+    return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+TelemetryRing :: TelemetryRing(uint32_t slotCount, uint32_t recordSize) 
+    : slotCount(slotCount), recordSize(recordSize) 
+{
+    slotSize = roundUp(sizeof(TelemetryRingSlot) + recordSize, CACHE_LINE_SIZE);
+    const size_t headerSize = roundUp(sizeof(TelemetryRingHeader), CACHE_LINE_SIZE);
+    mappedSize = headerSize + (size_t) slotCount * slotSize;
+
+    fd = memfd_create("xwiimote-mouse-telemetry", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        throw TelemetryRingCreationFailed(std::string("memfd_create: ") + strerror(errno));
+    }
+    if (ftruncate(fd, mappedSize) < 0) {
+        const std::string error = std::string("ftruncate: ") + strerror(errno);
+        close(fd);
+        throw TelemetryRingCreationFailed(error);
+    }
+    // Readers must not be able to resize the memory under the writer
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+
+    void* mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        const std::string error = std::string("mmap: ") + strerror(errno);
+        close(fd);
+        throw TelemetryRingCreationFailed(error);
+    }
+    memory = (uint8_t*) mapped;
+
+    // Keeps the mapping above writable but rejects all new writable
+    // mappings and writes, also through descriptors reopened by readers
+#ifdef F_SEAL_FUTURE_WRITE
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) < 0) {
+        std::cerr << "Telemetry ring is writable by its readers: " << strerror(errno) << std::endl;
+    }
+#else
+    std::cerr << "Telemetry ring is writable by its readers: F_SEAL_FUTURE_WRITE not supported" << std::endl;
+#endif
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL);
+
+    // The memfd is zero-filled, so all slot sequences start out even
+    header = new (memory) TelemetryRingHeader;
+    header->magic = TELEMETRY_RING_MAGIC;
+    header->version = TELEMETRY_RING_VERSION;
+    header->headerSize = headerSize;
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->recordSize = recordSize;
+    header->published.store(0, std::memory_order_release);
+}
+
+TelemetryRing :: ~TelemetryRing() {
+    munmap(memory, mappedSize);
+    close(fd);
+}
@@ -0,0 +1,107 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <exception>
+
+#include <stdint.h>
+
+class TelemetryRingCreationFailed : public std::exception {
+private:
+    std::string error;
+public:
+    TelemetryRingCreationFailed(const std::string& error) : error(error) {}
+    TelemetryRingCreationFailed(const TelemetryRingCreationFailed& other) = default;
+
+    const char* what() const noexcept override {
+        return error.c_str();
+    }
+};
+
+static const uint32_t TELEMETRY_RING_MAGIC = 0x52544D57; // "WMTR"
+static const uint32_t TELEMETRY_RING_VERSION = 1;
+static const int DEFAULT_TELEMETRY_RING_SLOTS = 256;
+
+// Layout of the shared memory, see protocol.md. Readers map the memory
+// read-only and never write to it.
+struct TelemetryRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t slotCount;
+    uint32_t slotSize;
+    uint32_t recordSize;
+    // Number of records published so far. Record n is in slot n % slotCount.
+    std::atomic<uint64_t> published;
+};
+
+// Each slot starts with this header, the record follows right after it
+struct TelemetryRingSlot {
+    // Seqlock: odd while the record is being written
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+
+    uint8_t* record() {
+        return (uint8_t*) (this + 1);
+    }
+    const uint8_t* record() const {
+        return (const uint8_t*) (this + 1);
+    }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared atomics must be lock-free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared atomics must be lock-free");
+
+// Single-writer ring of fixed-size telemetry records in a memfd. Any
+// number of local readers can map it and follow the frames without
+// syscalls, the writer never waits for them.
+class TelemetryRing {
+private:
+    int fd;
+    size_t mappedSize;
+    uint8_t* memory;
+    TelemetryRingHeader* header;
+    uint32_t slotCount;
+    uint32_t slotSize;
+    uint32_t recordSize;
+
+    TelemetryRingSlot* slot(uint64_t index) {
+        return (TelemetryRingSlot*) (memory + header->headerSize + (index % slotCount) * slotSize);
+    }
+public:
+    TelemetryRing(const TelemetryRing& other) = delete;
+    TelemetryRing& operator=(const TelemetryRing& other) = delete;
+
+    // Copies recordSize bytes into the next slot
+    void publish(const void* record);
+
+    // Opens a new read-only file descriptor for the ring that can be 
+    // passed to a reader. The caller owns the returned descriptor.
+    int openReadOnly() const;
+
+    uint32_t getSlotCount() const {
+        return slotCount;
+    }
+    uint32_t getRecordSize() const {
+        return recordSize;
+    }
+
+    TelemetryRing(uint32_t slotCount, uint32_t recordSize);
+    ~TelemetryRing();
+};
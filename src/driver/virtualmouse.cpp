@@ -17,6 +17,9 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include "virtualmouse.hpp"
 
 #include <unordered_map>
+#include <chrono>
+
+#include <unistd.h>
 
 const std::vector<SupportedButton> SUPPORTED_BUTTONS = {
      {BTN_LEFT, "BTN_LEFT", "Left Button", "Mouse"},
@@ -309,3 +312,102 @@ const SupportedButton* findButtonByCode(int id) {
     }
     return it->second;
 }
+
+UinputOutputSink :: UinputOutputSink(int maxAbsValue) : dev(nullptr), uinput(nullptr) {
+    dev = libevdev_new();
+
+    libevdev_set_name(dev, "Wiimote-Mouse Virtual Pointer");
+    libevdev_set_id_version(dev, 0x3);
+
+    libevdev_enable_property(dev, INPUT_PROP_POINTER);
+    libevdev_enable_property(dev, INPUT_PROP_BUTTONPAD);
+
+    input_absinfo absx_data;
+    absx_data.minimum = 0;
+    absx_data.maximum = maxAbsValue;
+    absx_data.flat = 0;
+    absx_data.fuzz = 0;
+    absx_data.value = 0;
+    absx_data.resolution = 20;
+
+    libevdev_enable_event_type(dev, EV_ABS);
+    libevdev_enable_event_code(dev, EV_ABS, ABS_X, &absx_data);
+
+    input_absinfo absy_data;
+    absy_data.minimum = 0;
+    absy_data.maximum = maxAbsValue;
+    absy_data.flat = 0;
+    absy_data.fuzz = 0;
+    absy_data.value = 0;
+    absy_data.resolution = 20;
+
+    libevdev_enable_event_code(dev, EV_ABS, ABS_Y, &absy_data);
+
+    libevdev_enable_event_type(dev, EV_KEY);
+    libevdev_enable_event_code(dev, EV_KEY, BTN_TOOL_MOUSE, nullptr);
+
+    for (auto btn : SUPPORTED_BUTTONS) {
+        libevdev_enable_event_code(dev, EV_KEY, btn.code, nullptr);
+    }
+
+    int err = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput);
+    if (err < 0) {
+        libevdev_free(dev);
+        throw VirtualMouseCreationFailed("Failed to create uinput device");
+    }
+}
+
+UinputOutputSink :: ~UinputOutputSink() {
+    if (uinput) {
+        libevdev_uinput_destroy(uinput);
+    }
+    libevdev_free(dev);
+}
+
+void UinputOutputSink :: writeFrame(const input_event* events, int count) {
+    const ssize_t size = sizeof(input_event) * count;
+    if (write(libevdev_uinput_get_fd(uinput), events, size) != size) {
+        std::cerr << "Failed to write uinput frame" << std::endl;
+    }
+}
+
+RecordingOutputSink :: RecordingOutputSink(size_t capacity) : capacity(capacity), dropped(0) {
+    events.reserve(capacity);
+}
+
+RecordingOutputSink :: RecordingOutputSink(const std::string& path) : 
+    capacity(VirtualMouse::MAX_FRAME_EVENTS), 
+    dropped(0),
+    file(path, std::ios::binary | std::ios::trunc)
+{
+    if (!file.is_open()) {
+        throw VirtualMouseCreationFailed("Failed to open output file: " + path);
+    }
+    events.reserve(capacity);
+}
+
+void RecordingOutputSink :: writeFrame(const input_event* frame, int count) {
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+
+    if (file.is_open()) {
+        // The buffer only stages the current frame
+        events.clear();
+    }
+    for (int i = 0; i < count; i++) {
+        if (events.size() >= capacity) {
+            dropped++;
+            continue;
+        }
+        events.push_back(RecordedInputEvent{
+            now, frame[i].type, frame[i].code, frame[i].value
+        });
+    }
+    if (file.is_open()) {
+        file.write(
+            reinterpret_cast<const char*>(events.data()), 
+            sizeof(RecordedInputEvent) * events.size()
+        );
+    }
+}
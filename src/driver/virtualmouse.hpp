@@ -21,11 +21,28 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 #include <vector>
 #include <string>
 #include <map>
+#include <bitset>
+#include <memory>
+#include <fstream>
+#include <iostream>
+
+#include <stdint.h>
 
 #include <libevdev/libevdev-uinput.h>
 
 class VirtualMouseError : public std::exception {};
 class VirtualMouseInvalidArgumentError : public VirtualMouseError {};
+class VirtualMouseCreationFailed : public VirtualMouseError {
+private:
+    std::string error;
+public:
+    VirtualMouseCreationFailed(const std::string& error) : error(error) {}
+    VirtualMouseCreationFailed(const VirtualMouseCreationFailed& other) = default;
+
+    const char* what() const noexcept override {
+        return error.c_str();
+    }
+};
 
 struct SupportedButton {
     int code;
@@ -39,78 +56,180 @@ extern const std::vector<SupportedButton> SUPPORTED_BUTTONS;
 const SupportedButton* findButtonByName(const std::string& rawName);
 const SupportedButton* findButtonByCode(int code);
 
-struct VirtualMouse {
+// Destination of the events generated by VirtualMouse
+class MouseOutputSink {
+public:
+    // Receives one frame of events, always terminated by a SYN_REPORT
+    virtual void writeFrame(const input_event* events, int count) = 0;
+
+    virtual ~MouseOutputSink() = default;
+};
+
+// Injects the events into the system through a uinput device
+class UinputOutputSink : public MouseOutputSink {
+private:
     libevdev* dev;
     libevdev_uinput* uinput;
+public:
+    virtual void writeFrame(const input_event* events, int count) override;
 
-    int maxAbsValue;
+    UinputOutputSink(int maxAbsValue);
+    ~UinputOutputSink();
+};
 
-    VirtualMouse(int maxAbsValue) : dev(nullptr), uinput(nullptr), maxAbsValue(maxAbsValue) {
-        dev = libevdev_new();
+class NullOutputSink : public MouseOutputSink {
+public:
+    virtual void writeFrame(const input_event* events, int count) override {}
+};
 
-        libevdev_set_name(dev, "Wiimote-Mouse Virtual Pointer");
-        libevdev_set_id_version(dev, 0x3);
+struct RecordedInputEvent {
+    int64_t time; // steady clock, nanoseconds
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
 
-        libevdev_enable_property(dev, INPUT_PROP_POINTER);
-        libevdev_enable_property(dev, INPUT_PROP_BUTTONPAD);
+// Records all events with timestamps, either into a buffer preallocated
+// for `capacity` events or appended to a binary file of
+// RecordedInputEvent structs.
+class RecordingOutputSink : public MouseOutputSink {
+private:
+    std::vector<RecordedInputEvent> events;
+    size_t capacity;
+    size_t dropped;
+    std::ofstream file;
+public:
+    const std::vector<RecordedInputEvent>& recordedEvents() const {
+        return events;
+    }
 
-        input_absinfo absx_data;
-        absx_data.minimum = 0;
-        absx_data.maximum = maxAbsValue;
-        absx_data.flat = 0;
-        absx_data.fuzz = 0;
-        absx_data.value = 0;
-        absx_data.resolution = 20;
+    size_t droppedEvents() const {
+        return dropped;
+    }
 
-        libevdev_enable_event_type(dev, EV_ABS);
-        libevdev_enable_event_code(dev, EV_ABS, ABS_X, &absx_data);
+    void clear() {
+        events.clear();
+        dropped = 0;
+    }
 
-        input_absinfo absy_data;
-        absy_data.minimum = 0;
-        absy_data.maximum = maxAbsValue;
-        absy_data.flat = 0;
-        absy_data.fuzz = 0;
-        absy_data.value = 0;
-        absy_data.resolution = 20;
+    virtual void writeFrame(const input_event* events, int count) override;
 
-        libevdev_enable_event_code(dev, EV_ABS, ABS_Y, &absy_data);
+    RecordingOutputSink(size_t capacity);
+    RecordingOutputSink(const std::string& path);
+};
 
-        libevdev_enable_event_type(dev, EV_KEY);
-        libevdev_enable_event_code(dev, EV_KEY, BTN_TOOL_MOUSE, nullptr);
+struct VirtualMouse {
+    static const int MAX_FRAME_EVENTS = 64;
+
+    std::shared_ptr<MouseOutputSink> sink;
+
+    // Events of the current output frame. move() and button() only queue
+    // events that change the device state, flush() terminates the frame
+    // with a single SYN_REPORT and hands it to the sink in one call.
+    input_event frameEvents[MAX_FRAME_EVENTS];
+    int frameEventCount;
+
+    // Events handed to the sink, including the SYN_REPORTs
+    uint64_t writtenEvents;
+
+    bool toolReported;
+    int lastX, lastY;
+    std::bitset<KEY_CNT> keyStates;
+
+    void appendEvent(int type, int code, int value) {
+        input_event& ev = frameEvents[frameEventCount++];
+        ev.time.tv_sec = 0;
+        ev.time.tv_usec = 0;
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+    }
 
-        for (auto btn : SUPPORTED_BUTTONS) {
-            libevdev_enable_event_code(dev, EV_KEY, btn.code, nullptr);
+    void queueEvent(int type, int code, int value) {
+        // Keeps the last slot free for the SYN_REPORT
+        if (frameEventCount >= MAX_FRAME_EVENTS - 1) {
+            flush();
         }
+        appendEvent(type, code, value);
+    }
 
-        int err = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput);
-        if (err < 0) {
-            throw std::string("Failed to create uinput device");
+    void queueTool() {
+        if (!toolReported) {
+            queueEvent(EV_KEY, BTN_TOOL_MOUSE, 1);
+            toolReported = true;
         }
     }
 
+    VirtualMouse(std::shared_ptr<MouseOutputSink> sink) : 
+        sink(sink),
+        frameEventCount(0),
+        writtenEvents(0),
+        toolReported(false),
+        lastX(-1),
+        lastY(-1)
+    {}
+
+    VirtualMouse(int maxAbsValue) : 
+        VirtualMouse(std::make_shared<UinputOutputSink>(maxAbsValue)) {}
+
     void move(int x, int y) {
-        libevdev_uinput_write_event(uinput, EV_KEY, BTN_TOOL_MOUSE, 1);
-        libevdev_uinput_write_event(uinput, EV_ABS, ABS_X, x);
-        libevdev_uinput_write_event(uinput, EV_ABS, ABS_Y, y);
-        libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
+        if ((x == lastX) && (y == lastY)) {
+            return;
+        }
+        queueTool();
+        if (x != lastX) {
+            queueEvent(EV_ABS, ABS_X, x);
+            lastX = x;
+        }
+        if (y != lastY) {
+            queueEvent(EV_ABS, ABS_Y, y);
+            lastY = y;
+        }
     }
 
     void button(int key, bool pressed) {
-        if (key == KEY_RESERVED) {
+        if ((key == KEY_RESERVED) || (key < 0) || (key >= KEY_CNT)) {
             throw VirtualMouseInvalidArgumentError();
         }
+        if (keyStates[key] == pressed) {
+            return;
+        }
+        keyStates[key] = pressed;
 
-        int state = pressed ? 1 : 0;
+        queueTool();
+        queueEvent(EV_KEY, key, pressed ? 1 : 0);
+    }
 
-        libevdev_uinput_write_event(uinput, EV_KEY, BTN_TOOL_MOUSE, 1);
-        libevdev_uinput_write_event(uinput, EV_KEY, key, state);
-        libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
+    // Writes all queued events as one frame. Does nothing and returns
+    // false if no event was queued since the last flush.
+    bool flush() {
+        if (frameEventCount <= 0) {
+            return false;
+        }
+        appendEvent(EV_SYN, SYN_REPORT, 0);
+
+        const int count = frameEventCount;
+        frameEventCount = 0;
+        writtenEvents += count;
+        sink->writeFrame(frameEvents, count);
+        return true;
     }
 
-    ~VirtualMouse() {
-        if (uinput) {
-            libevdev_uinput_destroy(uinput);
+    // Releases every pressed key in a frame of its own. The sink may
+    // outlive this mouse, keys must not stay pressed on it.
+    void releaseAll() {
+        for (int key = 0; key < (int) keyStates.size(); key++) {
+            if (keyStates[key]) {
+                button(key, false);
+            }
         }
-        libevdev_free(dev);
+        flush();
     }
+
+    ~VirtualMouse() {
+        releaseAll();
+    }
+
+    VirtualMouse(const VirtualMouse& other) = delete;
+    VirtualMouse& operator=(const VirtualMouse& other) = delete;
 };
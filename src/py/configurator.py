@@ -15,7 +15,7 @@ xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
 """
 
 import sys
-from typing import Any, Tuple, Optional, List, Union, Callable
+from typing import Any, Tuple, Optional, List, Union, Callable, Dict
 import tkinter as tk
 import tkinter.font as tkf
 from tkinter import ttk
@@ -53,9 +53,9 @@ WIIMOTE_BUTTON_READABLE_NAMES = OrderedDict(
 @dataclass
 class OpenCommand:
     start_time: int
+    request_id: int
     name: str
     params: Tuple[Any]
-    sock: socket.socket
     callback: Any = None
 
 
@@ -71,20 +71,30 @@ class WiimoteSocketReader:
 
         self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
         self.sock.connect(self.socket_path)
-        self.sock.settimeout(1)
+        self.sock.setblocking(False)
+        self.in_buffer = b""
+        for topic in ("ir", "flr", "buttons"):
+            self.sock.sendall(f"subscribe:{topic}\n".encode())
 
         self.lr_vectors = None
         self.ir_vectors = [None] * 4
         self.pressed_buttons = []
 
-        self.open_commands = []
+        # Commands are pipelined on the main socket, replies are matched by
+        # their request id
+        self.next_request_id = 1
+        self.open_commands = OrderedDict()
         self.closed_commands = []
 
         self.timer_id = self.root.after(self.poll_interval, self.process)
 
     def process_message(self, message: str):
         message_parts = message.strip().split(":")
-        if message_parts[0] == "flr":
+        if message_parts[0].startswith("#"):
+            cmd = self.open_commands.get(message_parts[0][1:])
+            if cmd is not None:
+                self.process_response_message(cmd, message_parts[1:])
+        elif message_parts[0] == "flr":
             if message_parts[1] == "invalid":
                 self.lr_vectors = None
             else:
@@ -102,43 +112,48 @@ class WiimoteSocketReader:
                 self.ir_vectors[index] = np.array([int(x) for x in message_parts[3:5]])
         elif message_parts[0] == "b":
             self.pressed_buttons = [m for m in message_parts[1:] if m]
+        elif message_parts[0] in ["OK", "ERROR"]:
+            pass
         else:
             print(f"Unknown message: {message}")
 
     def send_message(self, name: str, *params, callback=None):
-        req_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-        req_sock.connect(self.socket_path)
-        req_sock.settimeout(0.2)
+        request_id = str(self.next_request_id)
+        self.next_request_id += 1
 
-        self.open_commands.append(
-            OpenCommand(time.time(), name, params, req_sock, callback)
+        self.open_commands[request_id] = OpenCommand(
+            time.time(), request_id, name, params, callback
         )
 
-        data = (":".join([name] + [str(x) for x in params]) + "\n").encode()
-        padding = b"\0" * 1024
-        req_sock.sendall(data + padding)
-
-    def decode_in_buffer(self, buffer):
-        for line in buffer.decode().split("\n"):
-            line = line.strip()
-            if line:
-                yield line
+        data = ":".join([f"#{request_id}", name] + [str(x) for x in params]) + "\n"
+        self.sock.setblocking(True)
+        try:
+            self.sock.sendall(data.encode())
+        finally:
+            self.sock.setblocking(False)
 
     def read_input_socket(self):
         try:
-            data = self.sock.recv(1024)
-            if not data:
-                return
-            for message in self.decode_in_buffer(data):
-                self.process_message(message)
+            while True:
+                data = self.sock.recv(65536)
+                if not data:
+                    break
+                self.in_buffer += data
+        except BlockingIOError:
+            pass
         except IOError as e:
             print(f"Error reading main socket: {e}")
 
-    def process_response_message(self, cmd: OpenCommand, message: str):
-        message_parts = message.strip().split(":")
-        if message_parts[0] in ("ERROR", "OK"):
-            self.open_commands.remove(cmd)
-            cmd.sock.close()
+        # Only complete lines are processed, the rest waits for more data
+        *lines, self.in_buffer = self.in_buffer.split(b"\n")
+        for line in lines:
+            line = line.decode().strip()
+            if line:
+                self.process_message(line)
+
+    def process_response_message(self, cmd: OpenCommand, message_parts: List[str]):
+        if message_parts and message_parts[0] in ("ERROR", "OK"):
+            del self.open_commands[cmd.request_id]
             self.closed_commands.insert(0, (cmd, message_parts[0]))
             while len(self.closed_commands) > self.MAX_CLOSED_COMMANDS:
                 self.closed_commands.pop()
@@ -146,23 +161,9 @@ class WiimoteSocketReader:
             if cmd.callback:
                 cmd.callback(message_parts[0], message_parts[1:])
 
-    def receive_open_command_responses(self):
-        for cmd in list(self.open_commands):
-            try:
-                data = cmd.sock.recv(1024)
-                if not data:
-                    continue
-                for message in self.decode_in_buffer(data):
-                    self.process_response_message(cmd, message)
-            except IOError as e:
-                print(f"Error reading response for: {cmd.name}: {e}")
-
-        self.closed_commands = self.closed_commands[-self.MAX_CLOSED_COMMANDS :]
-
     def process(self):
         try:
             self.read_input_socket()
-            self.receive_open_command_responses()
             self.notify_callback()
         finally:
             self.timer_id = self.root.after(self.poll_interval, self.process)
@@ -173,8 +174,6 @@ class WiimoteSocketReader:
             self.timer_id = None
 
             self.sock.close()
-            for cmd in self.open_commands:
-                cmd.sock.close()
             self.open_commands.clear()
 
 
@@ -784,109 +783,86 @@ class CalibrationLogic(Logic):
         self.win.btn_start_calibration.pack(side=tk.TOP, fill=tk.X, pady=5, padx=0)
 
 
-def query_keybindings(window: Window, wiimote: WiimoteSocketReader):
-    def query_keymap():
-        def received(reps, args):
-            if reps != "OK":
-                print("ERROR getting keymap: ", args)
-                return
-
-            pairs = zip(args[::3], args[1::3], args[2::3])
-            for wiiButtonName, irState, targetButtonName in pairs:
-                irState = bool(int(irState))
-                window.keybindings.set_mapping(
-                    wiiButtonName,
-                    irState,
-                    targetButtonName,
-                )
-
-        wiimote.send_message("keymapget", callback=received)
-
-    def query_keys(wiimote: WiimoteSocketReader):
-        BATCH_SIZE = 10
-
-        current_batch = []
-        batch_index = 0
-        key_count = 0
-
-        def query_key(i: int):
-            current_batch.append(i)
-
-            def received(reps, args):
-                current_batch.remove(i)
-                query_next_batch()
-                if reps != "OK":
-                    print("ERROR getting key index: ", i)
-                    return
-
-                def filter_none(x):
-                    if x == "":
-                        return None
-                    return x
-
-                kb = KeybindingOption(*(filter_none(x) for x in args))
-                window.keybindings.add_value(kb)
-
-            wiimote.send_message("keyget", i, callback=received)
-
-        def query_next_batch():
-            nonlocal batch_index
-
-            if current_batch:
-                return
-
-            while (batch_index < key_count) and (len(current_batch) < BATCH_SIZE):
-                query_key(batch_index)
-                batch_index += 1
-
-            if len(current_batch) == 0:
-                query_keymap()
+def query_key_catalog(window: Window, wiimote: WiimoteSocketReader):
+    def received(reps, args):
+        if reps != "OK":
+            print("ERROR getting key list: ", args)
+            return
 
-        def count_received(resp, args):
-            nonlocal key_count
+        def filter_none(x):
+            if x == "":
+                return None
+            return x
+
+        key_count = int(args[0])
+        for i in range(key_count):
+            fields = args[1 + 3 * i : 4 + 3 * i]
+            kb = KeybindingOption(*(filter_none(x) for x in fields))
+            window.keybindings.add_value(kb)
+
+    wiimote.send_message("keylist", callback=received)
+
+
+def parse_settings_sections(args: List[str]) -> Dict[str, List[str]]:
+    """Splits a getall reply into its name, count, values... sections"""
+    sections = {}
+    i = 0
+    while i + 1 < len(args):
+        name, count = args[i], int(args[i + 1])
+        sections[name] = args[i + 2 : i + 2 + count]
+        i += 2 + count
+    return sections
+
+
+def apply_keymap(window: Window, args: List[str]):
+    pairs = zip(args[::3], args[1::3], args[2::3])
+    for wiiButtonName, irState, targetButtonName in pairs:
+        irState = bool(int(irState))
+        window.keybindings.set_mapping(
+            wiiButtonName,
+            irState,
+            targetButtonName,
+        )
 
-            if resp != "OK":
-                print("error getting key count: ", args)
-                return
 
-            key_count = int(args[0])
-            query_next_batch()
+def apply_smoothing_factors(window: Window, args: List[str]):
+    window.smoothing_pressed_var.set(int(args[0]) / 100)
+    window.smoothing_released_var.set(int(args[1]) / 100)
+    window.smoothing_click_freeze_var.set(int(args[2]) / 100000)
+    window.smoothing_parameters_enabled = True
 
-        wiimote.send_message("keycount", callback=count_received)
 
-    query_keys(wiimote)
+def apply_towed_circle_radius(
+    window: Window, wiimote: WiimoteSocketReader, args: List[str]
+):
+    window.towed_circle_radius_var.set(int(args[0]) / 10000)
 
+    def update_value():
+        wiimote.send_message(
+            "settcradius10000", int(window.towed_circle_radius_var.get() * 10000)
+        )
 
-def query_smoothing_factors(window: Window, wiimote: WiimoteSocketReader):
-    def received(reps, args):
-        if reps != "OK":
-            print("ERROR getting smoothing factors: ", args)
-            return
+    window.towed_circle_radius_var.trace_add("write", lambda *args: update_value())
 
-        window.smoothing_pressed_var.set(int(args[0]) / 100)
-        window.smoothing_released_var.set(int(args[1]) / 100)
-        window.smoothing_click_freeze_var.set(int(args[2]) / 100000)
-        window.smoothing_parameters_enabled = True
 
-    wiimote.send_message("getsmoothing100", callback=received)
+def apply_screen_area(window: Window, args: List[str]):
+    for sv, text in zip(window.screen_area_text_values, args):
+        sv.set(str(int(text) // 10000) + "%")
 
 
-def query_towed_circle_radius(window: Window, wiimote: WiimoteSocketReader):
+def query_settings(window: Window, wiimote: WiimoteSocketReader):
     def received(reps, args):
         if reps != "OK":
-            print("ERROR getting towed circle radius: ", args)
+            print("ERROR getting settings: ", args)
             return
 
-        window.towed_circle_radius_var.set(int(args[0]) / 10000)
-
-        def update_value():
-            wiimote.send_message(
-                "settcradius10000", int(window.towed_circle_radius_var.get() * 10000)
-            )
-
-        window.towed_circle_radius_var.trace_add("write", lambda *args: update_value())
+        sections = parse_settings_sections(args)
+        apply_keymap(window, sections["keymap"])
+        apply_smoothing_factors(window, sections["smoothing100"])
+        apply_towed_circle_radius(window, wiimote, sections["tcradius10000"])
+        apply_screen_area(window, sections["screenarea100"])
 
-    wiimote.send_message("gettcradius10000", callback=received)
+    wiimote.send_message("getall", callback=received)
 
 
 FREE_SORFTWARE_COPTYRIGHT_NOTICE = """
@@ -949,19 +925,10 @@ def main():
     wiimote = WiimoteSocketReader(args.socket_path, root, new_socket_data)
     wiimote.send_message("mouse", "off")
 
-    query_keybindings(window, wiimote)
-    query_smoothing_factors(window, wiimote)
-    query_towed_circle_radius(window, wiimote)
-
-    def assign_screenarea(cmd, topLeftBottomRight100):
-        if cmd == "ERROR":
-            print("Error getting screen area")
-            return
-
-        for sv, text in zip(window.screen_area_text_values, topLeftBottomRight100):
-            sv.set(str(int(text) // 10000) + "%")
-
-    wiimote.send_message("getscreenarea100", callback=assign_screenarea)
+    # Key bindings can only be shown once the catalog is known, replies
+    # arrive in request order
+    query_key_catalog(window, wiimote)
+    query_settings(window, wiimote)
 
     idle_logic = IdleLogic(window, wiimote)
     current_logic = idle_logic
@@ -0,0 +1,196 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or (at your option)
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+
+#include "../driver/filterlayers/clustering.hpp"
+
+// The two-iterations k-means clustering that IrSpotClustering used before
+// the exhaustive partition kernel, kept here as a reference.
+struct LegacyIrSpotClustering {
+    bool valid = false;
+    Vector3 leftPoint;
+    Vector3 rightPoint;
+
+    void processIrSpots(const IRData* irSpots) {
+        int noValid = 0;
+        const IRData* validList[4];
+        std::fill(validList, validList + 4, nullptr);
+        for (int i = 0; i < 4; i++) {
+            if (irSpots[i].valid) {
+                validList[noValid] = irSpots + i;
+                noValid++;
+            }
+        }
+
+        Scalar distanceMatrix[4][4];
+        for (int i = 0; i < noValid; i++) {
+            for (int j = 0; j < noValid; j++) {
+                if (i > j) {
+                    distanceMatrix[i][j] = distanceMatrix[j][i];
+                } else if (i == j) {
+                    distanceMatrix[i][j] = 0;
+                } else {
+                    distanceMatrix[i][j] = (validList[i]->point - validList[j]->point).len();
+                }
+            }
+        }
+
+        if (noValid == 0) {
+            valid = false;
+            return;
+        }
+        valid = true;
+        if (noValid == 1) {
+            rightPoint = leftPoint = validList[0]->point;
+            return;
+        }
+
+        Vector3 clusterPoints[2] = {
+            leftPoint.redivide(100),
+            rightPoint.redivide(100)
+        };
+        if (leftPoint == rightPoint) {
+            clusterPoints[1] = rightPoint + Vector3(1, 0, 0);
+        }
+
+        for (int _iter = 0; _iter < 2; _iter++) {
+            Vector3 clusterSums[2] = {Vector3(), Vector3()};
+            int clusterCounts[2] = {0, 0};
+
+            for (int i = 0; i < noValid; i++) {
+                int closestCluster = -1;
+                Scalar closestDistance = 0L;
+                for (int c = 0; c < 2; c++) {
+                    Scalar d = (validList[i]->point - clusterPoints[c]).len();
+                    if ((d < closestDistance) || (closestCluster < 0)) {
+                        closestDistance = d;
+                        closestCluster = c;
+                    }
+                }
+                clusterSums[closestCluster] = clusterSums[closestCluster] + validList[i]->point;
+                clusterCounts[closestCluster]++;
+            }
+
+            for (int i = 0; i < 2; i++) {
+                if (clusterCounts[i] > 0) {
+                    clusterPoints[i] = clusterSums[i] / clusterCounts[i];
+                }
+                clusterPoints[i] = clusterPoints[i].redivide(100);
+            }
+
+            if (clusterCounts[0] == 0) {
+                clusterCounts[0] = clusterCounts[1];
+                clusterPoints[0] = clusterPoints[1];
+                clusterCounts[1] = 0;
+            }
+            if (clusterCounts[1] == 0) {
+                Scalar maxDistance = 0;
+                int maxDistanceIndex = 0;
+                for (int i = 0; i < noValid; i++) {
+                    Scalar d = (validList[i]->point - clusterPoints[0]).len();
+                    if (d > maxDistance) {
+                        maxDistance = d;
+                        maxDistanceIndex = i;
+                    }
+                }
+                clusterPoints[1] = validList[maxDistanceIndex]->point.redivide(100);
+            }
+        }
+
+        leftPoint = clusterPoints[0].undivide();
+        rightPoint = clusterPoints[1].undivide();
+    }
+};
+
+struct Frame {
+    IRData spots[4];
+};
+
+// Simulates a sensor bar with two lamps per side drifting across the
+// sensor, with occasional dropouts and reordered report slots.
+static std::vector<Frame> generateFrames(int count) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> jitter(-3.0f, 3.0f);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    std::vector<Frame> frames(count);
+    float cx = 512, cy = 384, vx = 2.0f, vy = 1.3f;
+    for (Frame& frame : frames) {
+        cx += vx;
+        cy += vy;
+        if ((cx < 200) || (cx > 824)) vx = -vx;
+        if ((cy < 150) || (cy > 618)) vy = -vy;
+
+        const float lamps[4][2] = {
+            {cx - 120, cy}, {cx - 100, cy + 4},
+            {cx + 100, cy}, {cx + 120, cy + 4}
+        };
+        int slot = percent(rng) % 4;
+        for (int i = 0; i < 4; i++) {
+            IRData& spot = frame.spots[(slot + i) % 4];
+            spot.valid = percent(rng) >= 10;
+            spot.point = Vector3(
+                (int64_t) (lamps[i][0] + jitter(rng)),
+                (int64_t) (lamps[i][1] + jitter(rng)),
+                0L
+            );
+        }
+    }
+    return frames;
+}
+
+template <typename Clustering>
+static double benchmark(const std::vector<Frame>& frames, int rounds, double& spacing) {
+    Clustering clustering;
+    spacing = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (const Frame& frame : frames) {
+            clustering.processIrSpots(frame.spots);
+            if (clustering.valid) {
+                spacing += Vector3f(clustering.rightPoint)[0] - Vector3f(clustering.leftPoint)[0];
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    spacing /= (double) frames.size() * rounds;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()
+        / ((double) frames.size() * rounds);
+}
+
+int main() {
+    const std::vector<Frame> frames = generateFrames(10000);
+    const int rounds = 20;
+
+    double legacySpacing, partitionSpacing;
+    const double legacyNs = benchmark<LegacyIrSpotClustering>(frames, rounds, legacySpacing);
+    const double partitionNs = benchmark<IrSpotClustering>(frames, rounds, partitionSpacing);
+
+    std::cout << "----- IR spot clustering -----" << std::endl;
+    std::cout << "k-means (legacy):      " << legacyNs << " ns/frame, "
+        << "mean right-left x: " << legacySpacing << std::endl;
+    std::cout << "exhaustive partitions: " << partitionNs << " ns/frame, "
+        << "mean right-left x: " << partitionSpacing << std::endl;
+    std::cout << "Expected: mean right-left x close to 220 (no side flips)" << std::endl;
+
+    return 0;
+}
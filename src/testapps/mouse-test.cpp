@@ -29,25 +29,29 @@ int main() {
         std::getline(std::cin, s);
 
         mouse.move(10, 500);
+        mouse.flush();
 
         std::cout << "Press enter to move mouse again!" << std::endl;
         std::getline(std::cin, s);
 
         mouse.move(500, 50);
+        mouse.flush();
 
         std::cout << "Press enter to press the A-key!" << std::endl;
         std::getline(std::cin, s);
 
         mouse.button(KEY_A, true);
+        mouse.flush();
         mouse.button(KEY_A, false);
+        mouse.flush();
 
         std::cout << "Press enter to quit" << std::endl;
         std::getline(std::cin, s);
 
         std::cout << "Quitting" << std::endl;
     }
-    catch (const std::string& s) {
-        std::cout << "ERROR: " << s << std::endl;
+    catch (const VirtualMouseCreationFailed& e) {
+        std::cout << "ERROR: " << e.what() << std::endl;
     }
 
     return 0;
@@ -0,0 +1,140 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or (at your option)
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "../driver/telemetryring.hpp"
+
+// Asks the driver for its telemetry ring and follows it for a few seconds,
+// reporting how many frames were read and how many were missed.
+
+static int receiveRingFd(int sock, std::string& reply) {
+    char buffer[1024];
+    iovec iov = {buffer, sizeof(buffer) - 1};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } control;
+
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+
+    const ssize_t n = recvmsg(sock, &header, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buffer[n] = 0;
+    reply = buffer;
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+    if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    const std::string socketPath = (argc > 1) ? argv[1] : "./wiimote-mouse.sock";
+
+    const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(sock, (sockaddr*) &addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to connect to " << socketPath << std::endl;
+        return 1;
+    }
+
+    const std::string request = "telemetryring\n";
+    if (write(sock, request.data(), request.size()) != (ssize_t) request.size()) {
+        std::cerr << "Failed to send request" << std::endl;
+        return 1;
+    }
+    std::string reply;
+    const int fd = receiveRingFd(sock, reply);
+    std::cout << "Reply: " << reply;
+    if (fd < 0) {
+        std::cerr << "No file descriptor received" << std::endl;
+        return 1;
+    }
+
+    TelemetryRingHeader probe;
+    if (pread(fd, (void*) &probe, sizeof(probe), 0) != sizeof(probe)) {
+        std::cerr << "Failed to read ring header" << std::endl;
+        return 1;
+    }
+    if ((probe.magic != TELEMETRY_RING_MAGIC) || (probe.version != TELEMETRY_RING_VERSION)) {
+        std::cerr << "Unknown ring format" << std::endl;
+        return 1;
+    }
+    const size_t size = probe.headerSize + (size_t) probe.slotCount * probe.slotSize;
+    const uint8_t* memory = (const uint8_t*) mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Failed to map ring" << std::endl;
+        return 1;
+    }
+    const TelemetryRingHeader* header = (const TelemetryRingHeader*) memory;
+
+    std::vector<uint8_t> record(header->recordSize);
+    uint64_t next = header->published.load(std::memory_order_acquire);
+    uint64_t read = 0, missed = 0, retries = 0;
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < end) {
+        const uint64_t published = header->published.load(std::memory_order_acquire);
+        if (published - next > header->slotCount) {
+            missed += published - next - header->slotCount;
+            next = published - header->slotCount;
+        }
+        while (next < published) {
+            const TelemetryRingSlot* slot = (const TelemetryRingSlot*) (
+                memory + header->headerSize + (next % header->slotCount) * header->slotSize
+            );
+            const uint32_t before = slot->sequence.load(std::memory_order_acquire);
+            memcpy(record.data(), slot->record(), record.size());
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint32_t after = slot->sequence.load(std::memory_order_relaxed);
+            if ((before & 1) || (before != after)) {
+                retries++;
+                break;
+            }
+            read++;
+            next++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::cout << "Frames read: " << read << ", missed: " << missed 
+        << ", retries: " << retries << std::endl;
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+This file is part of xwiimote-mouse-driver.
+
+xwiimote-mouse-driver is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free 
+Software Foundation, either version 3 of the License, or (at your option) 
+any later version.
+
+xwiimote-mouse-driver is distributed in the hope that it will be useful, but WITHOUT 
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+xwiimote-mouse-driver. If not, see <https://www.gnu.org/licenses/>. 
+*/
+
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../driver/virtualmouse.hpp"
+
+// Checks that keys held when a mouse goes away are released on the sink,
+// which outlives the mouse when the wiimote reconnects.
+
+static int failures = 0;
+
+static void check(bool condition, const char* description) {
+    if (!condition) {
+        std::cerr << "FAILED: " << description << std::endl;
+        failures++;
+    }
+}
+
+static bool isPressed(const std::vector<RecordedInputEvent>& events, int key) {
+    bool pressed = false;
+    for (const RecordedInputEvent& event : events) {
+        if ((event.type == EV_KEY) && (event.code == key)) {
+            pressed = event.value != 0;
+        }
+    }
+    return pressed;
+}
+
+int main() {
+    auto sink = std::make_shared<RecordingOutputSink>(1024);
+
+    {
+        VirtualMouse mouse(sink);
+        mouse.move(100, 100);
+        mouse.button(BTN_LEFT, true);
+        mouse.button(KEY_A, true);
+        mouse.flush();
+        check(isPressed(sink->recordedEvents(), BTN_LEFT), "BTN_LEFT pressed");
+        check(isPressed(sink->recordedEvents(), KEY_A), "KEY_A pressed");
+
+        mouse.releaseAll();
+        check(!isPressed(sink->recordedEvents(), BTN_LEFT), "releaseAll releases BTN_LEFT");
+        check(!isPressed(sink->recordedEvents(), KEY_A), "releaseAll releases KEY_A");
+        check(sink->recordedEvents().back().type == EV_SYN, "releases end with a SYN_REPORT");
+
+        const size_t count = sink->recordedEvents().size();
+        mouse.releaseAll();
+        check(sink->recordedEvents().size() == count, "nothing written without pressed keys");
+
+        mouse.button(BTN_RIGHT, true);
+        mouse.flush();
+    }
+    check(!isPressed(sink->recordedEvents(), BTN_RIGHT), "destruction releases BTN_RIGHT");
+    check(sink->recordedEvents().back().type == EV_SYN, "destruction ends with a SYN_REPORT");
+    check(sink->droppedEvents() == 0, "no events dropped");
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}